@@ -0,0 +1,105 @@
+
+#include "alert-dialog.h"
+
+#include <glib/gi18n.h>
+#include <gtk/gtk.h>
+
+#define RESPONSE_SHOW_SYSTEM_SETTINGS 1
+
+typedef struct
+{
+    AlertDialogResponseFunc func;
+    gpointer user_data;
+} Response;
+
+
+static void
+on_response (GtkDialog *dialog,
+             gint response_id,
+             gpointer user_data)
+{
+    Response *response = user_data;
+
+    response->func (response_id == RESPONSE_SHOW_SYSTEM_SETTINGS,
+                    response->user_data);
+}
+
+
+static gpointer
+alert_dialog_create (AlertDialogResponseFunc func,
+                     gpointer user_data)
+{
+    GtkWidget *dialog;
+    GtkWidget *image;
+    Response *response;
+
+    image = gtk_image_new_from_icon_name ("printer", GTK_ICON_SIZE_DIALOG);
+
+    dialog = g_object_new (GTK_TYPE_MESSAGE_DIALOG,
+                           "title", _("Printing Problem"),
+                           "icon-name", "printer",
+                           "image", image,
+                           "urgency-hint", TRUE,
+                           "focus-on-map", FALSE,
+                           "window-position", GTK_WIN_POS_CENTER,
+                           "skip-taskbar-hint", FALSE,
+                           "deletable", FALSE,
+                           NULL);
+
+    gtk_dialog_add_buttons (GTK_DIALOG (dialog),
+                            _("_Settings…"), RESPONSE_SHOW_SYSTEM_SETTINGS,
+                            GTK_STOCK_OK, GTK_RESPONSE_OK,
+                            NULL);
+    gtk_dialog_set_default_response (GTK_DIALOG (dialog),
+                                     GTK_RESPONSE_OK);
+
+    response = g_new (Response, 1);
+    response->func = func;
+    response->user_data = user_data;
+    g_signal_connect_data (dialog, "response",
+                           G_CALLBACK (on_response), response,
+                           (GClosureNotify) g_free, 0);
+
+    return dialog;
+}
+
+
+static void
+alert_dialog_set_text (gpointer dialog,
+                       const gchar *text,
+                       const gchar *secondary_text)
+{
+    g_object_set (dialog,
+                  "text", text,
+                  "secondary-text", secondary_text,
+                  NULL);
+
+    gtk_widget_show_all (dialog);
+}
+
+
+static void
+alert_dialog_destroy (gpointer dialog)
+{
+    gtk_widget_destroy (dialog);
+}
+
+
+/* Initializes GTK when called for the first time.  Returns NULL if that
+ * failed, e.g. because there is no display. */
+const AlertDialogFuncs *
+alert_dialog_get_funcs (void)
+{
+    static const AlertDialogFuncs funcs = {
+        alert_dialog_create,
+        alert_dialog_set_text,
+        alert_dialog_destroy
+    };
+    static gboolean initialized;
+
+    if (!initialized && !gtk_init_check (NULL, NULL))
+        return NULL;
+    initialized = TRUE;
+
+    return &funcs;
+}
@@ -0,0 +1,30 @@
+
+#ifndef ALERT_DIALOG_H
+#define ALERT_DIALOG_H
+
+#include <glib.h>
+
+/* The printer alert dialogs live in a module of their own, so that the
+ * service only loads and initializes GTK once the first dialog is shown. */
+
+#define ALERT_DIALOG_MODULE_NAME "indicator-printers-alert-dialog"
+#define ALERT_DIALOG_MODULE_SYMBOL "alert_dialog_get_funcs"
+
+typedef void (*AlertDialogResponseFunc) (gboolean show_settings,
+                                         gpointer user_data);
+
+typedef struct
+{
+    gpointer (*create) (AlertDialogResponseFunc response,
+                        gpointer user_data);
+    void (*set_text) (gpointer dialog,
+                      const gchar *text,
+                      const gchar *secondary_text);
+    void (*destroy) (gpointer dialog);
+} AlertDialogFuncs;
+
+typedef const AlertDialogFuncs * (*AlertDialogGetFuncs) (void);
+
+const AlertDialogFuncs * alert_dialog_get_funcs (void);
+
+#endif
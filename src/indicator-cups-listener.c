@@ -0,0 +1,483 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-cups-listener.h"
+
+#include <gio/gio.h>
+
+#include "dbus-names.h"
+
+
+G_DEFINE_TYPE (IndicatorCupsListener, indicator_cups_listener, G_TYPE_OBJECT)
+
+
+/* Receives the signals of cupsd's dbus notifier on a thread of its own and
+ * emits them on a CupsNotifier skeleton in the main thread, in place of a
+ * CupsNotifier proxy.
+ *
+ * The thread only decodes the arguments that are used (printer name and
+ * state, printer-state-reasons, job id and state) into fixed-size records.
+ * Those are handed to the main thread through a single-producer,
+ * single-consumer ring; the main thread is woken up once per batch.  If the
+ * ring is full or a printer name doesn't fit into its record, the event is
+ * dropped and "events-lost" is emitted.
+ * printer-state-reasons that don't fit into a record are cut off after the
+ * last keyword that fits. */
+
+
+/* number of records in the ring, a power of two */
+#define QUEUE_SIZE 256
+
+
+typedef enum
+{
+    EVENT_JOB,
+    EVENT_PRINTER,
+    EVENT_SERVER
+} EventKind;
+
+
+/* the signals that are forwarded: D-Bus member -> CupsNotifier signal */
+static const struct {
+    const gchar *member;
+    const gchar *signal;
+    EventKind kind;
+} cups_signals[] = {
+    { "JobCreated", "job-created", EVENT_JOB },
+    { "JobState", "job-state", EVENT_JOB },
+    { "JobCompleted", "job-completed", EVENT_JOB },
+    { "PrinterAdded", "printer-added", EVENT_PRINTER },
+    { "PrinterDeleted", "printer-deleted", EVENT_PRINTER },
+    { "PrinterModified", "printer-modified", EVENT_PRINTER },
+    { "PrinterStateChanged", "printer-state-changed", EVENT_PRINTER },
+    { "ServerStarted", "server-started", EVENT_SERVER },
+    { "ServerRestarted", "server-restarted", EVENT_SERVER },
+    { "ServerStopped", "server-stopped", EVENT_SERVER }
+};
+
+/* the parameter types of cups_signals, from the generated interface info */
+static GVariantType *cups_signal_types[G_N_ELEMENTS (cups_signals)];
+
+
+typedef struct
+{
+    guint signal;               /* index into cups_signals */
+    guint printer_state;
+    guint job_id;
+    guint job_state;
+    gchar printer[128];
+    gchar reasons[256];
+} Event;
+
+
+struct _IndicatorCupsListenerPrivate
+{
+    CupsNotifier *cups_notifier;
+
+    GThread *thread;
+    GMainContext *context;      /* of the thread */
+    GMainLoop *loop;
+
+    /* the ring: the thread only writes tail, the main thread only head */
+    Event queue[QUEUE_SIZE];
+    gint head;
+    gint tail;
+
+    /* set by the thread, reset by the main thread */
+    gint wakeup_pending;
+    guint drain_id;
+    gint overflowed;
+    gint failed;
+
+    gint received;
+    gint jobs_created;
+    gint dropped;
+    gint mismatched;            /* signals with unexpected parameters */
+};
+
+
+enum {
+    EVENTS_LOST,
+    CONNECTION_FAILED,
+    NUM_SIGNALS
+};
+
+static guint signals[NUM_SIGNALS];
+
+
+static gboolean drain_queue (gpointer user_data);
+
+
+/* called in the thread */
+static void
+wake_main_thread (IndicatorCupsListener *self)
+{
+    if (g_atomic_int_compare_and_exchange (&self->priv->wakeup_pending, 0, 1))
+        self->priv->drain_id = g_idle_add_full (G_PRIORITY_DEFAULT, drain_queue,
+                                                self, NULL);
+}
+
+
+/* Copies as many whole keywords of the space or comma separated src as
+ * fit into dest.  Called in the thread. */
+static void
+copy_keywords (gchar *dest,
+               gsize size,
+               const gchar *src)
+{
+    gsize len;
+
+    if (g_strlcpy (dest, src, size) < size)
+        return;
+
+    len = size - 1;
+    while (len > 0 && src[len] != ' ' && src[len] != ',')
+        len--;
+    dest[len] = '\0';
+
+    g_debug ("printer-state-reasons cut off to '%s'", dest);
+}
+
+
+/* called in the thread */
+static void
+on_signal (GDBusConnection *connection,
+           const gchar *sender_name,
+           const gchar *object_path,
+           const gchar *interface_name,
+           const gchar *signal_name,
+           GVariant *parameters,
+           gpointer user_data)
+{
+    IndicatorCupsListener *self = user_data;
+    IndicatorCupsListenerPrivate *priv = self->priv;
+    Event *event;
+    const gchar *str;
+    gboolean fits = TRUE;
+    guint tail;
+    guint i;
+
+    g_atomic_int_inc (&priv->received);
+
+    for (i = 0; i < G_N_ELEMENTS (cups_signals); i++) {
+        if (g_str_equal (cups_signals[i].member, signal_name))
+            break;
+    }
+    if (i == G_N_ELEMENTS (cups_signals))
+        return;
+
+    if (!g_variant_is_of_type (parameters, cups_signal_types[i])) {
+        if (g_atomic_int_add (&priv->mismatched, 1) == 0)
+            g_warning ("Ignoring %s signal with parameters of type %s instead of %s",
+                       signal_name, g_variant_get_type_string (parameters),
+                       g_variant_type_peek_string (cups_signal_types[i]));
+        return;
+    }
+
+    if (g_str_equal (signal_name, "JobCreated"))
+        g_atomic_int_inc (&priv->jobs_created);
+
+    tail = (guint) priv->tail;
+    if (tail - (guint) g_atomic_int_get (&priv->head) == QUEUE_SIZE) {
+        g_atomic_int_inc (&priv->dropped);
+        g_atomic_int_set (&priv->overflowed, 1);
+        wake_main_thread (self);
+        return;
+    }
+
+    event = &priv->queue[tail % QUEUE_SIZE];
+    event->signal = i;
+
+    if (cups_signals[i].kind != EVENT_SERVER) {
+        g_variant_get_child (parameters, 2, "&s", &str);
+        fits &= g_strlcpy (event->printer, str, sizeof event->printer) < sizeof event->printer;
+        g_variant_get_child (parameters, 3, "u", &event->printer_state);
+    }
+
+    if (cups_signals[i].kind == EVENT_PRINTER) {
+        g_variant_get_child (parameters, 4, "&s", &str);
+        copy_keywords (event->reasons, sizeof event->reasons, str);
+    }
+
+    if (cups_signals[i].kind == EVENT_JOB) {
+        g_variant_get_child (parameters, 6, "u", &event->job_id);
+        g_variant_get_child (parameters, 7, "u", &event->job_state);
+    }
+
+    if (!fits) {
+        g_atomic_int_inc (&priv->dropped);
+        g_atomic_int_set (&priv->overflowed, 1);
+        wake_main_thread (self);
+        return;
+    }
+
+    /* publishes the record */
+    g_atomic_int_set (&priv->tail, (gint) (tail + 1));
+    wake_main_thread (self);
+}
+
+
+static gpointer
+listener_thread (gpointer user_data)
+{
+    IndicatorCupsListener *self = user_data;
+    GDBusConnection *bus;
+    guint subscription_id;
+    GError *error = NULL;
+
+    g_main_context_push_thread_default (self->priv->context);
+
+    bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (!bus) {
+        g_warning ("Error connecting to the system bus: %s", error->message);
+        g_error_free (error);
+        g_atomic_int_set (&self->priv->failed, 1);
+        wake_main_thread (self);
+        goto out;
+    }
+
+    /* signals are dispatched in the thread-default context of the caller */
+    subscription_id = g_dbus_connection_signal_subscribe (bus,
+                                                          NULL,
+                                                          CUPS_DBUS_INTERFACE,
+                                                          NULL,
+                                                          CUPS_DBUS_PATH,
+                                                          NULL,
+                                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                                          on_signal,
+                                                          self,
+                                                          NULL);
+
+    g_main_loop_run (self->priv->loop);
+
+    g_dbus_connection_signal_unsubscribe (bus, subscription_id);
+    g_object_unref (bus);
+
+out:
+    g_main_context_pop_thread_default (self->priv->context);
+    return NULL;
+}
+
+
+static void
+emit_event (IndicatorCupsListener *self,
+            Event *event)
+{
+    const gchar *signal = cups_signals[event->signal].signal;
+
+    switch (cups_signals[event->signal].kind)
+    {
+        case EVENT_JOB:
+            g_signal_emit_by_name (self->priv->cups_notifier, signal,
+                                   "", "", event->printer, event->printer_state,
+                                   "", FALSE, event->job_id, event->job_state,
+                                   "", "", 0);
+            break;
+
+        case EVENT_PRINTER:
+            g_signal_emit_by_name (self->priv->cups_notifier, signal,
+                                   "", "", event->printer, event->printer_state,
+                                   event->reasons, FALSE);
+            break;
+
+        case EVENT_SERVER:
+            g_signal_emit_by_name (self->priv->cups_notifier, signal, "");
+            break;
+    }
+}
+
+
+static gboolean
+drain_queue (gpointer user_data)
+{
+    IndicatorCupsListener *self = INDICATOR_CUPS_LISTENER (user_data);
+    IndicatorCupsListenerPrivate *priv = self->priv;
+    guint head, tail;
+
+    /* records published after this wake us up again */
+    g_atomic_int_set (&priv->wakeup_pending, 0);
+
+    head = (guint) priv->head;
+    tail = (guint) g_atomic_int_get (&priv->tail);
+
+    while (head != tail) {
+        emit_event (self, &priv->queue[head % QUEUE_SIZE]);
+        head++;
+
+        /* hands the record back to the thread */
+        g_atomic_int_set (&priv->head, (gint) head);
+    }
+
+    if (g_atomic_int_compare_and_exchange (&priv->overflowed, 1, 0))
+        g_signal_emit (self, signals[EVENTS_LOST], 0);
+
+    if (g_atomic_int_compare_and_exchange (&priv->failed, 1, 0))
+        g_signal_emit (self, signals[CONNECTION_FAILED], 0);
+
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean
+quit_loop (gpointer user_data)
+{
+    g_main_loop_quit (user_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+constructed (GObject *object)
+{
+    IndicatorCupsListener *self = INDICATOR_CUPS_LISTENER (object);
+
+    self->priv->thread = g_thread_new ("cups-listener", listener_thread, self);
+
+    G_OBJECT_CLASS (indicator_cups_listener_parent_class)->constructed (object);
+}
+
+
+static void
+dispose (GObject *object)
+{
+    IndicatorCupsListener *self = INDICATOR_CUPS_LISTENER (object);
+
+    if (self->priv->thread) {
+        /* runs once the loop is running, even if it hasn't started yet */
+        g_main_context_invoke (self->priv->context, quit_loop, self->priv->loop);
+        g_thread_join (self->priv->thread);
+        self->priv->thread = NULL;
+
+        if (g_atomic_int_get (&self->priv->wakeup_pending)) {
+            g_source_remove (self->priv->drain_id);
+            self->priv->wakeup_pending = 0;
+        }
+    }
+
+    g_clear_object (&self->priv->cups_notifier);
+
+    G_OBJECT_CLASS (indicator_cups_listener_parent_class)->dispose (object);
+}
+
+
+static void
+finalize (GObject *object)
+{
+    IndicatorCupsListener *self = INDICATOR_CUPS_LISTENER (object);
+
+    g_main_loop_unref (self->priv->loop);
+    g_main_context_unref (self->priv->context);
+
+    G_OBJECT_CLASS (indicator_cups_listener_parent_class)->finalize (object);
+}
+
+
+static void
+indicator_cups_listener_class_init (IndicatorCupsListenerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    GDBusInterfaceInfo *info = cups_notifier_interface_info ();
+    guint i;
+
+    g_type_class_add_private (klass, sizeof (IndicatorCupsListenerPrivate));
+
+    for (i = 0; i < G_N_ELEMENTS (cups_signals); i++) {
+        GDBusSignalInfo *signal_info;
+        GString *type;
+        guint j;
+
+        signal_info = g_dbus_interface_info_lookup_signal (info, cups_signals[i].member);
+        g_assert (signal_info != NULL);
+
+        type = g_string_new ("(");
+        for (j = 0; signal_info->args && signal_info->args[j]; j++)
+            g_string_append (type, signal_info->args[j]->signature);
+        g_string_append_c (type, ')');
+
+        cups_signal_types[i] = g_variant_type_new (type->str);
+        g_string_free (type, TRUE);
+    }
+
+    object_class->constructed = constructed;
+    object_class->dispose = dispose;
+    object_class->finalize = finalize;
+
+    /* signals were dropped because the main thread fell behind */
+    signals[EVENTS_LOST] = g_signal_new ("events-lost",
+                                         INDICATOR_TYPE_CUPS_LISTENER,
+                                         G_SIGNAL_RUN_FIRST,
+                                         0,
+                                         NULL, NULL,
+                                         g_cclosure_marshal_VOID__VOID,
+                                         G_TYPE_NONE, 0);
+
+    /* the system bus isn't available, no signals will arrive */
+    signals[CONNECTION_FAILED] = g_signal_new ("connection-failed",
+                                               INDICATOR_TYPE_CUPS_LISTENER,
+                                               G_SIGNAL_RUN_FIRST,
+                                               0,
+                                               NULL, NULL,
+                                               g_cclosure_marshal_VOID__VOID,
+                                               G_TYPE_NONE, 0);
+}
+
+
+static void
+indicator_cups_listener_init (IndicatorCupsListener *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              INDICATOR_TYPE_CUPS_LISTENER,
+                                              IndicatorCupsListenerPrivate);
+
+    self->priv->cups_notifier = cups_notifier_skeleton_new ();
+    self->priv->context = g_main_context_new ();
+    self->priv->loop = g_main_loop_new (self->priv->context, FALSE);
+}
+
+
+IndicatorCupsListener *
+indicator_cups_listener_new (void)
+{
+    return g_object_new (INDICATOR_TYPE_CUPS_LISTENER, NULL);
+}
+
+
+/* Returns the object on which the received signals are emitted */
+CupsNotifier *
+indicator_cups_listener_get_cups_notifier (IndicatorCupsListener *self)
+{
+    return self->priv->cups_notifier;
+}
+
+
+void
+indicator_cups_listener_get_stats (IndicatorCupsListener *self,
+                                   guint *received,
+                                   guint *jobs_created,
+                                   guint *dropped,
+                                   guint *mismatched)
+{
+    if (received)
+        *received = g_atomic_int_get (&self->priv->received);
+    if (jobs_created)
+        *jobs_created = g_atomic_int_get (&self->priv->jobs_created);
+    if (dropped)
+        *dropped = g_atomic_int_get (&self->priv->dropped);
+    if (mismatched)
+        *mismatched = g_atomic_int_get (&self->priv->mismatched);
+}
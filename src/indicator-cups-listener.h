@@ -0,0 +1,77 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_CUPS_LISTENER_H
+#define INDICATOR_CUPS_LISTENER_H
+
+#include <glib-object.h>
+
+#include "cups-notifier.h"
+
+G_BEGIN_DECLS
+
+#define INDICATOR_TYPE_CUPS_LISTENER indicator_cups_listener_get_type()
+
+#define INDICATOR_CUPS_LISTENER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  INDICATOR_TYPE_CUPS_LISTENER, IndicatorCupsListener))
+
+#define INDICATOR_CUPS_LISTENER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  INDICATOR_TYPE_CUPS_LISTENER, IndicatorCupsListenerClass))
+
+#define INDICATOR_IS_CUPS_LISTENER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  INDICATOR_TYPE_CUPS_LISTENER))
+
+#define INDICATOR_IS_CUPS_LISTENER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  INDICATOR_TYPE_CUPS_LISTENER))
+
+#define INDICATOR_CUPS_LISTENER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  INDICATOR_TYPE_CUPS_LISTENER, IndicatorCupsListenerClass))
+
+typedef struct _IndicatorCupsListener IndicatorCupsListener;
+typedef struct _IndicatorCupsListenerClass IndicatorCupsListenerClass;
+typedef struct _IndicatorCupsListenerPrivate IndicatorCupsListenerPrivate;
+
+struct _IndicatorCupsListener
+{
+  GObject parent;
+  IndicatorCupsListenerPrivate *priv;
+};
+
+struct _IndicatorCupsListenerClass
+{
+  GObjectClass parent_class;
+};
+
+GType indicator_cups_listener_get_type (void) G_GNUC_CONST;
+
+IndicatorCupsListener * indicator_cups_listener_new (void);
+CupsNotifier * indicator_cups_listener_get_cups_notifier (IndicatorCupsListener *self);
+void indicator_cups_listener_get_stats (IndicatorCupsListener *self,
+                                        guint *received,
+                                        guint *jobs_created,
+                                        guint *dropped,
+                                        guint *mismatched);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,826 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-cups-subscription.h"
+
+#include <cups/cups.h>
+
+
+G_DEFINE_TYPE (IndicatorCupsSubscription, indicator_cups_subscription, G_TYPE_OBJECT)
+
+
+#define NOTIFY_LEASE_DURATION (24 * 60 * 60)
+
+/* don't hold up the session logout for long if cupsd doesn't answer */
+#define CANCEL_SUBSCRIPTION_TIMEOUT 2000
+
+/* seconds to wait before creating the subscription again after a failure,
+ * doubled with every further failure */
+#define MIN_RETRY_DELAY 1
+#define MAX_RETRY_DELAY 300
+
+
+/* the events handled by the store, and those of cupsd itself which are
+ * needed to notice that it was restarted */
+static const gchar * const default_notify_events[] = {
+    "job-created",
+    "job-state-changed",
+    "job-completed",
+    "printer-added",
+    "printer-deleted",
+    "printer-modified",
+    "printer-state-changed",
+    "server-started",
+    "server-restarted",
+    "server-stopped",
+    NULL
+};
+
+
+struct _IndicatorCupsSubscriptionPrivate
+{
+    IndicatorIppClient *ipp_client;
+    IndicatorPrintersStore *store;
+    CupsNotifier *cups_notifier;
+    GPtrArray *notify_events;
+
+    gint subscription_id;
+    gboolean subscribing;
+
+    /* events are fetched with Get-Notifications instead of being sent as
+     * D-Bus signals by cupsd's dbus notifier */
+    gboolean pull;
+
+    /* a subscription that is replaced by one for more events is cancelled
+     * once the new one exists */
+    gboolean resubscribe;
+    gint replaced_id;
+
+    guint renew_id;
+    guint retry_id;
+    guint retry_delay;
+    gboolean cancelled;
+
+    /* returned once a subscription that was being created when the
+     * subscription was cancelled is gone as well */
+    GTask *cancel_task;
+
+    /* the store is reloaded once after the first subscription exists, and
+     * after every restart of cupsd, as events might have been lost in the
+     * meantime */
+    gboolean resync_pending;
+    gboolean cupsd_available;
+};
+
+
+enum {
+    PROP_0,
+    PROP_IPP_CLIENT,
+    PROP_STORE,
+    PROP_CUPS_NOTIFIER,
+    PROP_CUPSD_AVAILABLE,
+    PROP_PULL,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *properties[NUM_PROPERTIES];
+
+
+enum {
+    RECIPIENT_REJECTED,
+    NUM_SIGNALS
+};
+
+static guint signals[NUM_SIGNALS];
+
+
+static void create_subscription (IndicatorCupsSubscription *self);
+
+
+static void
+set_cupsd_available (IndicatorCupsSubscription *self,
+                     gboolean available)
+{
+    if (self->priv->cupsd_available == available)
+        return;
+
+    self->priv->cupsd_available = available;
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_CUPSD_AVAILABLE]);
+}
+
+
+/* Reloads the store if that is pending and events are coming in, i.e. both
+ * the subscription and the proxy for its signals exist. */
+static void
+maybe_resync (IndicatorCupsSubscription *self)
+{
+    if (!self->priv->resync_pending ||
+        self->priv->subscription_id <= 0 ||
+        !self->priv->cups_notifier)
+        return;
+
+    self->priv->resync_pending = FALSE;
+    if (self->priv->store)
+        indicator_printers_store_queue_resync (self->priv->store);
+}
+
+
+static gboolean
+retry_timeout (gpointer user_data)
+{
+    IndicatorCupsSubscription *self = user_data;
+
+    self->priv->retry_id = 0;
+    if (self->priv->subscription_id <= 0 && !self->priv->subscribing &&
+        !self->priv->cancelled)
+        create_subscription (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+schedule_retry (IndicatorCupsSubscription *self)
+{
+    if (self->priv->retry_id)
+        return;
+
+    self->priv->retry_id = g_timeout_add_seconds (self->priv->retry_delay,
+                                                  retry_timeout, self);
+    self->priv->retry_delay = MIN (self->priv->retry_delay * 2, MAX_RETRY_DELAY);
+}
+
+
+static void
+subscription_cancelled (GObject *source_object,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+    GTask *task = user_data;
+    ipp_t *resp;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (resp) {
+        ippDelete (resp);
+        if (task)
+            g_task_return_boolean (task, TRUE);
+    }
+    else {
+        g_warning ("Error cancelling CUPS subscription: %s", error->message);
+        if (task)
+            g_task_return_error (task, error);
+        else
+            g_error_free (error);
+    }
+
+    if (task)
+        g_object_unref (task);
+}
+
+
+/* task may be NULL if nobody is waiting for the subscription to be gone */
+static void
+cancel_subscription (IndicatorCupsSubscription *self,
+                     gint id,
+                     GTask *task)
+{
+    ipp_t *req;
+
+    req = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "printer-uri", NULL, "/");
+    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                   "notify-subscription-id", id);
+
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     CANCEL_SUBSCRIPTION_TIMEOUT, NULL,
+                                     subscription_cancelled, task);
+}
+
+
+/* Whether a request failed because cupsd couldn't be reached, as opposed
+ * to cupsd refusing it.  libcups reports connection failures as
+ * IPP_SERVICE_UNAVAILABLE. */
+static gboolean
+is_transport_error (const GError *error)
+{
+    return error->domain == G_IO_ERROR ||
+           g_error_matches (error, INDICATOR_IPP_ERROR, IPP_SERVICE_UNAVAILABLE);
+}
+
+
+static void
+subscription_created (GObject *source_object,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (user_data);
+    ipp_t *resp;
+    ipp_attribute_t *attr;
+    gint id = 0;
+    GError *error = NULL;
+
+    self->priv->subscribing = FALSE;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (resp) {
+        attr = ippFindAttribute (resp, "notify-subscription-id", IPP_TAG_INTEGER);
+        if (attr)
+            id = ippGetInteger (attr, 0);
+        ippDelete (resp);
+    }
+
+    /* the service is shutting down: cancel the new subscription too, and
+     * only then tell whoever is waiting for that */
+    if (self->priv->cancelled) {
+        GTask *task = self->priv->cancel_task;
+
+        self->priv->cancel_task = NULL;
+        g_clear_error (&error);
+        if (id > 0)
+            cancel_subscription (self, id, task);
+        else if (task) {
+            g_task_return_boolean (task, TRUE);
+            g_object_unref (task);
+        }
+        goto out;
+    }
+
+    /* cupsd was built without the dbus notifier */
+    if (!resp && !self->priv->pull && !is_transport_error (error)) {
+        g_warning ("cupsd doesn't send notifications over D-Bus: %s", error->message);
+        g_error_free (error);
+        set_cupsd_available (self, TRUE);
+
+        g_signal_emit (self, signals[RECIPIENT_REJECTED], 0);
+
+        /* a handler switched to ippget */
+        if (self->priv->pull && !self->priv->subscribing)
+            create_subscription (self);
+        else
+            schedule_retry (self);
+        goto out;
+    }
+
+    if (!resp) {
+        g_warning ("Error subscribing to CUPS notifications, retrying in %u seconds: %s",
+                   self->priv->retry_delay, error->message);
+        set_cupsd_available (self, !is_transport_error (error));
+        g_error_free (error);
+        schedule_retry (self);
+        goto out;
+    }
+
+    set_cupsd_available (self, TRUE);
+
+    if (id <= 0) {
+        g_warning ("ipp-create-printer-subscription response doesn't contain "
+                   "subscription id, retrying in %u seconds", self->priv->retry_delay);
+        schedule_retry (self);
+        goto out;
+    }
+
+    self->priv->subscription_id = id;
+    self->priv->retry_delay = MIN_RETRY_DELAY;
+
+    if (self->priv->replaced_id > 0) {
+        cancel_subscription (self, self->priv->replaced_id, NULL);
+        self->priv->replaced_id = 0;
+    }
+
+    /* events were added while this one was being created */
+    if (self->priv->resubscribe) {
+        self->priv->resubscribe = FALSE;
+        self->priv->replaced_id = self->priv->subscription_id;
+        self->priv->subscription_id = 0;
+        create_subscription (self);
+        goto out;
+    }
+
+    maybe_resync (self);
+
+out:
+    g_object_unref (self);
+}
+
+
+static void
+create_subscription (IndicatorCupsSubscription *self)
+{
+    ipp_t *req;
+
+    req = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "printer-uri", NULL, "/");
+    ippAddStrings (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+                   "notify-events", self->priv->notify_events->len, NULL,
+                   (const char * const *) self->priv->notify_events->pdata);
+    if (self->priv->pull)
+        ippAddString (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+                      "notify-pull-method", NULL, "ippget");
+    else
+        ippAddString (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
+                      "notify-recipient-uri", NULL, "dbus://");
+    ippAddInteger (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                   "notify-lease-duration", NOTIFY_LEASE_DURATION);
+
+    self->priv->subscribing = TRUE;
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     subscription_created, g_object_ref (self));
+}
+
+
+/* A failed renewal means that cupsd forgot about the subscription (or isn't
+ * running), so a new one is created. */
+static void
+subscription_renewed (GObject *source_object,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (user_data);
+    ipp_t *resp;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (resp) {
+        ippDelete (resp);
+        set_cupsd_available (self, TRUE);
+        maybe_resync (self);
+    }
+    else {
+        g_warning ("Error renewing CUPS subscription %d: %s",
+                   self->priv->subscription_id, error->message);
+        g_error_free (error);
+
+        self->priv->subscription_id = 0;
+        if (!self->priv->subscribing)
+            create_subscription (self);
+    }
+
+    g_object_unref (self);
+}
+
+
+static void
+renew_subscription (IndicatorCupsSubscription *self)
+{
+    ipp_t *req;
+
+    if (self->priv->subscribing)
+        return;
+
+    if (self->priv->subscription_id <= 0) {
+        create_subscription (self);
+        return;
+    }
+
+    req = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
+    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                   "notify-subscription-id", self->priv->subscription_id);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "printer-uri", NULL, "/");
+    if (!self->priv->pull)
+        ippAddString (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
+                      "notify-recipient-uri", NULL, "dbus://");
+    ippAddInteger (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                   "notify-lease-duration", NOTIFY_LEASE_DURATION);
+
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     subscription_renewed, g_object_ref (self));
+}
+
+
+static gboolean
+renew_subscription_timeout (gpointer user_data)
+{
+    renew_subscription (INDICATOR_CUPS_SUBSCRIPTION (user_data));
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+on_server_stopped (CupsNotifier *cups_notifier,
+                   const gchar *text,
+                   gpointer user_data)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (user_data);
+
+    set_cupsd_available (self, FALSE);
+}
+
+
+/* cupsd (re)started: make sure the subscription survived, and reload the
+ * store once that is settled.  Retries start over with the shortest delay,
+ * as cupsd is known to be back. */
+static void
+on_server_started (CupsNotifier *cups_notifier,
+                   const gchar *text,
+                   gpointer user_data)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (user_data);
+
+    self->priv->resync_pending = TRUE;
+    self->priv->retry_delay = MIN_RETRY_DELAY;
+    if (self->priv->retry_id) {
+        g_source_remove (self->priv->retry_id);
+        self->priv->retry_id = 0;
+    }
+
+    renew_subscription (self);
+}
+
+
+/* Creates a new subscription with the current events and method, and
+ * cancels the existing one once the new one is there. */
+static void
+replace_subscription (IndicatorCupsSubscription *self)
+{
+    /* nothing to replace before the first subscription */
+    if (self->priv->subscription_id <= 0 && !self->priv->subscribing)
+        return;
+
+    if (self->priv->subscribing) {
+        self->priv->resubscribe = TRUE;
+        return;
+    }
+
+    self->priv->replaced_id = self->priv->subscription_id;
+    self->priv->subscription_id = 0;
+    create_subscription (self);
+}
+
+
+static void
+get_property (GObject    *object,
+              guint       property_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (object);
+
+    switch (property_id)
+    {
+        case PROP_IPP_CLIENT:
+            g_value_set_object (value, self->priv->ipp_client);
+            break;
+
+        case PROP_STORE:
+            g_value_set_object (value, self->priv->store);
+            break;
+
+        case PROP_CUPS_NOTIFIER:
+            g_value_set_object (value, self->priv->cups_notifier);
+            break;
+
+        case PROP_CUPSD_AVAILABLE:
+            g_value_set_boolean (value, self->priv->cupsd_available);
+            break;
+
+        case PROP_PULL:
+            g_value_set_boolean (value, self->priv->pull);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+set_property (GObject      *object,
+              guint         property_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (object);
+
+    switch (property_id)
+    {
+        case PROP_IPP_CLIENT:
+            g_clear_object (&self->priv->ipp_client);
+            self->priv->ipp_client = g_value_dup_object (value);
+            break;
+
+        case PROP_STORE:
+            g_clear_object (&self->priv->store);
+            self->priv->store = g_value_dup_object (value);
+            break;
+
+        case PROP_CUPS_NOTIFIER:
+            indicator_cups_subscription_set_cups_notifier (self,
+                                                           g_value_get_object (value));
+            break;
+
+        case PROP_PULL:
+            indicator_cups_subscription_set_pull (self, g_value_get_boolean (value));
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+dispose (GObject *object)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (object);
+
+    if (self->priv->renew_id) {
+        g_source_remove (self->priv->renew_id);
+        self->priv->renew_id = 0;
+    }
+    if (self->priv->retry_id) {
+        g_source_remove (self->priv->retry_id);
+        self->priv->retry_id = 0;
+    }
+
+    indicator_cups_subscription_set_cups_notifier (self, NULL);
+    g_clear_object (&self->priv->store);
+    g_clear_object (&self->priv->ipp_client);
+
+    G_OBJECT_CLASS (indicator_cups_subscription_parent_class)->dispose (object);
+}
+
+
+static void
+finalize (GObject *object)
+{
+    IndicatorCupsSubscription *self = INDICATOR_CUPS_SUBSCRIPTION (object);
+
+    g_ptr_array_unref (self->priv->notify_events);
+
+    G_OBJECT_CLASS (indicator_cups_subscription_parent_class)->finalize (object);
+}
+
+
+static void
+indicator_cups_subscription_class_init (IndicatorCupsSubscriptionClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (IndicatorCupsSubscriptionPrivate));
+
+    object_class->get_property = get_property;
+    object_class->set_property = set_property;
+    object_class->dispose = dispose;
+    object_class->finalize = finalize;
+
+    properties[PROP_IPP_CLIENT] = g_param_spec_object ("ipp-client",
+                                                       "IPP Client",
+                                                       "Client used for requests to cupsd",
+                                                       INDICATOR_TYPE_IPP_CLIENT,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_STORE] = g_param_spec_object ("store",
+                                                  "Store",
+                                                  "Store that is reloaded after events were lost",
+                                                  INDICATOR_TYPE_PRINTERS_STORE,
+                                                  G_PARAM_READWRITE |
+                                                  G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_CUPS_NOTIFIER] = g_param_spec_object ("cups-notifier",
+                                                          "Cups Notifier",
+                                                          "A cups notifier object",
+                                                          CUPS_TYPE_NOTIFIER,
+                                                          G_PARAM_READWRITE);
+
+    properties[PROP_CUPSD_AVAILABLE] = g_param_spec_boolean ("cupsd-available",
+                                                             "Cupsd Available",
+                                                             "Whether cupsd is known to be running",
+                                                             FALSE,
+                                                             G_PARAM_READABLE);
+
+    properties[PROP_PULL] = g_param_spec_boolean ("pull",
+                                                  "Pull",
+                                                  "Whether events are fetched with Get-Notifications",
+                                                  FALSE,
+                                                  G_PARAM_READWRITE);
+
+    g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
+
+    /* cupsd refused to send the events as D-Bus signals.  The subscription
+     * keeps retrying that until it is switched to pulling them. */
+    signals[RECIPIENT_REJECTED] = g_signal_new ("recipient-rejected",
+                                                G_TYPE_FROM_CLASS (klass),
+                                                G_SIGNAL_RUN_LAST,
+                                                0,
+                                                NULL, NULL,
+                                                g_cclosure_marshal_VOID__VOID,
+                                                G_TYPE_NONE, 0);
+}
+
+
+static void
+indicator_cups_subscription_init (IndicatorCupsSubscription *self)
+{
+    const gchar * const *e;
+
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              INDICATOR_TYPE_CUPS_SUBSCRIPTION,
+                                              IndicatorCupsSubscriptionPrivate);
+
+    self->priv->notify_events = g_ptr_array_new_with_free_func (g_free);
+    for (e = default_notify_events; *e; e++)
+        g_ptr_array_add (self->priv->notify_events, g_strdup (*e));
+
+    self->priv->retry_delay = MIN_RETRY_DELAY;
+    self->priv->resync_pending = TRUE;
+}
+
+
+CupsNotifier *
+indicator_cups_subscription_get_cups_notifier (IndicatorCupsSubscription *self)
+{
+    return self->priv->cups_notifier;
+}
+
+
+void
+indicator_cups_subscription_set_cups_notifier (IndicatorCupsSubscription *self,
+                                               CupsNotifier *cups_notifier)
+{
+    if (self->priv->cups_notifier) {
+        g_object_disconnect (self->priv->cups_notifier,
+                             "any-signal", on_server_started, self,
+                             "any-signal", on_server_stopped, self,
+                             NULL);
+        g_clear_object (&self->priv->cups_notifier);
+    }
+
+    if (cups_notifier) {
+        self->priv->cups_notifier = g_object_ref (cups_notifier);
+        g_object_connect (self->priv->cups_notifier,
+                          "signal::server-started", on_server_started, self,
+                          "signal::server-restarted", on_server_started, self,
+                          "signal::server-stopped", on_server_stopped, self,
+                          NULL);
+        maybe_resync (self);
+    }
+}
+
+
+/* Adds events to the subscription.  If any of them weren't part of it yet
+ * and a subscription exists already, a new one is created; the old one is
+ * cancelled once that has happened. */
+void
+indicator_cups_subscription_require_events (IndicatorCupsSubscription *self,
+                                            const gchar * const *events)
+{
+    GPtrArray *notify_events = self->priv->notify_events;
+    gboolean changed = FALSE;
+    const gchar * const *e;
+    guint i;
+
+    for (e = events; *e; e++) {
+        for (i = 0; i < notify_events->len; i++) {
+            if (g_str_equal (g_ptr_array_index (notify_events, i), *e))
+                break;
+        }
+        if (i == notify_events->len) {
+            g_ptr_array_add (notify_events, g_strdup (*e));
+            changed = TRUE;
+        }
+    }
+
+    if (changed)
+        replace_subscription (self);
+}
+
+
+/* Switches between a subscription whose events are sent as D-Bus signals
+ * and one whose events are fetched with Get-Notifications (see
+ * IndicatorIppgetNotifier).  An existing subscription is replaced. */
+void
+indicator_cups_subscription_set_pull (IndicatorCupsSubscription *self,
+                                      gboolean pull)
+{
+    if (self->priv->pull == pull)
+        return;
+
+    self->priv->pull = pull;
+    replace_subscription (self);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PULL]);
+}
+
+
+gboolean
+indicator_cups_subscription_get_pull (IndicatorCupsSubscription *self)
+{
+    return self->priv->pull;
+}
+
+
+/* Makes sure the subscription still exists, creating a new one if cupsd
+ * forgot about it. */
+void
+indicator_cups_subscription_renew (IndicatorCupsSubscription *self)
+{
+    if (!self->priv->cancelled)
+        renew_subscription (self);
+}
+
+
+/* Creates the subscription and keeps it alive: it is renewed before its
+ * lease runs out, and created again whenever it turns out to be gone. */
+void
+indicator_cups_subscription_subscribe (IndicatorCupsSubscription *self)
+{
+    if (self->priv->renew_id)
+        return;
+
+    create_subscription (self);
+    self->priv->renew_id = g_timeout_add_seconds (NOTIFY_LEASE_DURATION - 60,
+                                                  renew_subscription_timeout,
+                                                  self);
+}
+
+
+/* Cancels the subscription in cupsd and stops renewing it.  The callback is
+ * called once cupsd answered (or right away if there is no subscription).
+ * If a subscription is being created, that is waited for and cancelled as
+ * well. */
+void
+indicator_cups_subscription_cancel_async (IndicatorCupsSubscription *self,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data)
+{
+    GTask *task;
+
+    task = g_task_new (self, NULL, callback, user_data);
+    self->priv->cancelled = TRUE;
+
+    if (self->priv->renew_id) {
+        g_source_remove (self->priv->renew_id);
+        self->priv->renew_id = 0;
+    }
+    if (self->priv->retry_id) {
+        g_source_remove (self->priv->retry_id);
+        self->priv->retry_id = 0;
+    }
+
+    if (self->priv->replaced_id > 0) {
+        cancel_subscription (self, self->priv->replaced_id, NULL);
+        self->priv->replaced_id = 0;
+    }
+
+    if (self->priv->subscription_id > 0) {
+        cancel_subscription (self, self->priv->subscription_id, task);
+        self->priv->subscription_id = 0;
+    }
+    else if (self->priv->subscribing) {
+        /* returned from subscription_created() */
+        self->priv->cancel_task = task;
+    }
+    else {
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+    }
+}
+
+
+gboolean
+indicator_cups_subscription_cancel_finish (IndicatorCupsSubscription *self,
+                                           GAsyncResult *result,
+                                           GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+
+gint
+indicator_cups_subscription_get_id (IndicatorCupsSubscription *self)
+{
+    return self->priv->subscription_id;
+}
+
+
+gboolean
+indicator_cups_subscription_get_cupsd_available (IndicatorCupsSubscription *self)
+{
+    return self->priv->cupsd_available;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_CUPS_SUBSCRIPTION_H
+#define INDICATOR_CUPS_SUBSCRIPTION_H
+
+#include <gio/gio.h>
+
+#include "cups-notifier.h"
+#include "indicator-ipp-client.h"
+#include "indicator-printers-store.h"
+
+G_BEGIN_DECLS
+
+#define INDICATOR_TYPE_CUPS_SUBSCRIPTION indicator_cups_subscription_get_type()
+
+#define INDICATOR_CUPS_SUBSCRIPTION(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  INDICATOR_TYPE_CUPS_SUBSCRIPTION, IndicatorCupsSubscription))
+
+#define INDICATOR_CUPS_SUBSCRIPTION_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  INDICATOR_TYPE_CUPS_SUBSCRIPTION, IndicatorCupsSubscriptionClass))
+
+#define INDICATOR_IS_CUPS_SUBSCRIPTION(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  INDICATOR_TYPE_CUPS_SUBSCRIPTION))
+
+#define INDICATOR_IS_CUPS_SUBSCRIPTION_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  INDICATOR_TYPE_CUPS_SUBSCRIPTION))
+
+#define INDICATOR_CUPS_SUBSCRIPTION_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  INDICATOR_TYPE_CUPS_SUBSCRIPTION, IndicatorCupsSubscriptionClass))
+
+typedef struct _IndicatorCupsSubscription IndicatorCupsSubscription;
+typedef struct _IndicatorCupsSubscriptionClass IndicatorCupsSubscriptionClass;
+typedef struct _IndicatorCupsSubscriptionPrivate IndicatorCupsSubscriptionPrivate;
+
+struct _IndicatorCupsSubscription
+{
+  GObject parent;
+  IndicatorCupsSubscriptionPrivate *priv;
+};
+
+struct _IndicatorCupsSubscriptionClass
+{
+  GObjectClass parent_class;
+};
+
+GType indicator_cups_subscription_get_type (void) G_GNUC_CONST;
+
+CupsNotifier * indicator_cups_subscription_get_cups_notifier (IndicatorCupsSubscription *self);
+void indicator_cups_subscription_set_cups_notifier (IndicatorCupsSubscription *self,
+                                                    CupsNotifier *cups_notifier);
+
+void indicator_cups_subscription_require_events (IndicatorCupsSubscription *self,
+                                                 const gchar * const *events);
+void indicator_cups_subscription_subscribe (IndicatorCupsSubscription *self);
+void indicator_cups_subscription_renew (IndicatorCupsSubscription *self);
+void indicator_cups_subscription_set_pull (IndicatorCupsSubscription *self,
+                                           gboolean pull);
+gboolean indicator_cups_subscription_get_pull (IndicatorCupsSubscription *self);
+void indicator_cups_subscription_cancel_async (IndicatorCupsSubscription *self,
+                                               GAsyncReadyCallback callback,
+                                               gpointer user_data);
+gboolean indicator_cups_subscription_cancel_finish (IndicatorCupsSubscription *self,
+                                                    GAsyncResult *result,
+                                                    GError **error);
+
+gint indicator_cups_subscription_get_id (IndicatorCupsSubscription *self);
+gboolean indicator_cups_subscription_get_cupsd_available (IndicatorCupsSubscription *self);
+
+G_END_DECLS
+
+#endif
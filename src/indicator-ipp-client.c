@@ -0,0 +1,577 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-ipp-client.h"
+
+#include <string.h>
+
+
+/* Sends IPP requests to cupsd without blocking the main loop.  Requests are
+ * run on a bounded pool of worker threads, each of which keeps its own
+ * connection to the server; the response is delivered to the thread-default
+ * main context of the caller of indicator_ipp_client_send_async(). */
+
+
+/* how often a blocked request wakes up to check for cancellation and its
+ * deadline */
+#define POLL_INTERVAL 0.25
+
+/* milliseconds to wait for a connection to cupsd when the request has no
+ * deadline */
+#define CONNECT_TIMEOUT 30000
+
+
+G_DEFINE_TYPE (IndicatorIppClient, indicator_ipp_client, G_TYPE_OBJECT)
+
+
+struct _IndicatorIppClientPrivate
+{
+    GThreadPool *workers;
+    guint max_connections;
+};
+
+
+enum {
+    PROP_0,
+    PROP_MAX_CONNECTIONS,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *properties[NUM_PROPERTIES];
+
+
+typedef struct
+{
+    ipp_t *request;
+    gchar *resource;
+    gint64 deadline;    /* monotonic time, 0 if the request has none */
+    gboolean aborted;
+} Request;
+
+
+/* responses of indicator_ipp_client_send_all_async(), in request order */
+typedef struct
+{
+    GPtrArray *responses;
+    guint pending;
+} Batch;
+
+
+typedef struct
+{
+    GTask *task;
+    guint index;
+} BatchItem;
+
+
+/* one connection per worker thread, closed when the thread exits */
+static GPrivate connection = G_PRIVATE_INIT ((GDestroyNotify) httpClose);
+
+
+G_DEFINE_QUARK (indicator-ipp-error-quark, indicator_ipp_error)
+
+
+static void
+request_free (Request *req)
+{
+    ippDelete (req->request);
+    g_free (req->resource);
+    g_slice_free (Request, req);
+}
+
+
+static void
+cancel_connect (GCancellable *cancellable,
+                gpointer user_data)
+{
+    int *cancel = user_data;
+
+    g_atomic_int_set (cancel, 1);
+}
+
+
+/* Returns the connection of the calling worker thread, connecting first if
+ * there is none.  Connecting gives up at the deadline of task's request or
+ * when task is cancelled. */
+static http_t *
+get_connection (GTask *task,
+                GError **error)
+{
+    Request *req = g_task_get_task_data (task);
+    GCancellable *cancellable = g_task_get_cancellable (task);
+    http_t *http;
+    int msec = CONNECT_TIMEOUT;
+    int cancel = 0;
+    gulong handler_id = 0;
+
+    http = g_private_get (&connection);
+    if (http)
+        return http;
+
+    /* 0 would mean not to connect at all */
+    if (req->deadline)
+        msec = MAX ((req->deadline - g_get_monotonic_time ()) / 1000, 1);
+
+    if (cancellable)
+        handler_id = g_cancellable_connect (cancellable, G_CALLBACK (cancel_connect),
+                                            &cancel, NULL);
+
+    http = httpConnect2 (cupsServer (), ippPort (), NULL, AF_UNSPEC,
+                         cupsEncryption (), 1, msec, &cancel);
+
+    g_cancellable_disconnect (cancellable, handler_id);
+
+    if (!http) {
+        if (g_atomic_int_get (&cancel))
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                         "Connecting to CUPS server %s was cancelled", cupsServer ());
+        else if (req->deadline && g_get_monotonic_time () >= req->deadline)
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                         "Timed out connecting to CUPS server %s", cupsServer ());
+        else
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Could not connect to CUPS server %s", cupsServer ());
+        return NULL;
+    }
+
+    g_private_set (&connection, http);
+    return http;
+}
+
+
+static void
+drop_connection ()
+{
+    g_private_replace (&connection, NULL);
+}
+
+
+/* called by libcups while it is waiting for the server; returning 0 aborts
+ * the request */
+static int
+check_request_timeout (http_t *http,
+                       void *user_data)
+{
+    GTask *task = user_data;
+    Request *req = g_task_get_task_data (task);
+
+    if (g_cancellable_is_cancelled (g_task_get_cancellable (task)) ||
+        (req->deadline && g_get_monotonic_time () >= req->deadline)) {
+        req->aborted = TRUE;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void
+run_request (gpointer data,
+             gpointer user_data)
+{
+    GTask *task = data;
+    Request *req = g_task_get_task_data (task);
+    http_t *http;
+    ipp_t *resp;
+    ipp_status_t status;
+    GError *error = NULL;
+
+    if (g_task_return_error_if_cancelled (task))
+        goto out;
+
+    if (req->deadline && g_get_monotonic_time () >= req->deadline) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                 "IPP request timed out before it was sent");
+        goto out;
+    }
+
+    http = get_connection (task, &error);
+    if (!http) {
+        g_task_return_error (task, error);
+        goto out;
+    }
+
+    httpSetTimeout (http, POLL_INTERVAL, check_request_timeout, task);
+
+    /* cupsDoRequest() frees the request */
+    resp = cupsDoRequest (http, req->request, req->resource);
+    req->request = NULL;
+    status = cupsLastError ();
+
+    if (req->aborted) {
+        ippDelete (resp);
+        drop_connection ();
+        if (!g_task_return_error_if_cancelled (task))
+            g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                     "IPP request timed out");
+        goto out;
+    }
+
+    if (!resp || status > IPP_OK_CONFLICT) {
+        if (!resp || status == IPP_SERVICE_UNAVAILABLE)
+            drop_connection ();
+        ippDelete (resp);
+        g_task_return_new_error (task, INDICATOR_IPP_ERROR, status,
+                                 "%s", cupsLastErrorString ());
+        goto out;
+    }
+
+    g_task_return_pointer (task, resp, (GDestroyNotify) ippDelete);
+
+out:
+    g_object_unref (task);
+}
+
+
+static void
+batch_free (Batch *batch)
+{
+    g_ptr_array_unref (batch->responses);
+    g_slice_free (Batch, batch);
+}
+
+
+static void
+batch_item_done (GObject *source_object,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+    BatchItem *item = user_data;
+    Batch *batch = g_task_get_task_data (item->task);
+    GError *error = NULL;
+    ipp_t *resp;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (!resp) {
+        g_debug ("IPP request %u of batch failed: %s", item->index, error->message);
+        g_error_free (error);
+    }
+
+    g_ptr_array_index (batch->responses, item->index) = resp;
+
+    if (--batch->pending == 0 &&
+        !g_task_return_error_if_cancelled (item->task))
+        g_task_return_pointer (item->task,
+                               g_ptr_array_ref (batch->responses),
+                               (GDestroyNotify) g_ptr_array_unref);
+
+    g_object_unref (item->task);
+    g_slice_free (BatchItem, item);
+}
+
+
+static void
+get_property (GObject    *object,
+              guint       property_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+    IndicatorIppClient *self = INDICATOR_IPP_CLIENT (object);
+
+    switch (property_id) {
+        case PROP_MAX_CONNECTIONS:
+            g_value_set_uint (value, self->priv->max_connections);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+set_property (GObject      *object,
+              guint         property_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    IndicatorIppClient *self = INDICATOR_IPP_CLIENT (object);
+
+    switch (property_id) {
+        case PROP_MAX_CONNECTIONS:
+            self->priv->max_connections = g_value_get_uint (value);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+constructed (GObject *object)
+{
+    IndicatorIppClient *self = INDICATOR_IPP_CLIENT (object);
+
+    self->priv->workers = g_thread_pool_new (run_request, self,
+                                             self->priv->max_connections,
+                                             TRUE, NULL);
+
+    G_OBJECT_CLASS (indicator_ipp_client_parent_class)->constructed (object);
+}
+
+
+static void
+dispose (GObject *object)
+{
+    IndicatorIppClient *self = INDICATOR_IPP_CLIENT (object);
+
+    /* every queued task holds a reference on the client, so there is no
+     * pending work left at this point.  Don't wait for the workers, this
+     * might run on one of them when it drops the last task. */
+    if (self->priv->workers) {
+        g_thread_pool_free (self->priv->workers, FALSE, FALSE);
+        self->priv->workers = NULL;
+    }
+
+    G_OBJECT_CLASS (indicator_ipp_client_parent_class)->dispose (object);
+}
+
+
+static void
+indicator_ipp_client_class_init (IndicatorIppClientClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (IndicatorIppClientPrivate));
+
+    object_class->get_property = get_property;
+    object_class->set_property = set_property;
+    object_class->constructed = constructed;
+    object_class->dispose = dispose;
+
+    properties[PROP_MAX_CONNECTIONS] = g_param_spec_uint ("max-connections",
+                                                          "Max Connections",
+                                                          "Number of worker threads, each "
+                                                          "with its own connection to cupsd",
+                                                          1, 64, 4,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
+}
+
+
+static void
+indicator_ipp_client_init (IndicatorIppClient *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              INDICATOR_TYPE_IPP_CLIENT,
+                                              IndicatorIppClientPrivate);
+}
+
+
+IndicatorIppClient *
+indicator_ipp_client_new (guint max_connections)
+{
+    return g_object_new (INDICATOR_TYPE_IPP_CLIENT,
+                         "max-connections", max_connections,
+                         NULL);
+}
+
+
+/* Sends request to cupsd and takes ownership of it.  If timeout_ms is not 0,
+ * the request fails with G_IO_ERROR_TIMED_OUT when no response arrived in
+ * that time, including the time it spent waiting in the queue. */
+void
+indicator_ipp_client_send_async (IndicatorIppClient *self,
+                                 ipp_t *request,
+                                 const gchar *resource,
+                                 guint timeout_ms,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+    GTask *task;
+    Request *req;
+
+    req = g_slice_new0 (Request);
+    req->request = request;
+    req->resource = g_strdup (resource ? resource : "/");
+    if (timeout_ms)
+        req->deadline = g_get_monotonic_time () + timeout_ms * G_TIME_SPAN_MILLISECOND;
+
+    task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_task_data (task, req, (GDestroyNotify) request_free);
+
+    g_thread_pool_push (self->priv->workers, task, NULL);
+}
+
+
+/* Returns the response of a request, or NULL if it failed.  Free the response
+ * with ippDelete(). */
+ipp_t *
+indicator_ipp_client_send_finish (IndicatorIppClient *self,
+                                  GAsyncResult *result,
+                                  GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+
+/* Sends all requests concurrently, as far as the size of the worker pool
+ * allows, and takes ownership of them.  The result is a GPtrArray holding the
+ * responses in the same order as requests; failed requests have NULL
+ * entries. */
+void
+indicator_ipp_client_send_all_async (IndicatorIppClient *self,
+                                     ipp_t **requests,
+                                     guint n_requests,
+                                     const gchar *resource,
+                                     guint timeout_ms,
+                                     GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data)
+{
+    GTask *task;
+    Batch *batch;
+    guint i;
+
+    batch = g_slice_new (Batch);
+    batch->responses = g_ptr_array_new_full (n_requests, (GDestroyNotify) ippDelete);
+    g_ptr_array_set_size (batch->responses, n_requests);
+    batch->pending = n_requests;
+
+    task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_task_data (task, batch, (GDestroyNotify) batch_free);
+
+    if (n_requests == 0) {
+        g_task_return_pointer (task, g_ptr_array_ref (batch->responses),
+                               (GDestroyNotify) g_ptr_array_unref);
+        g_object_unref (task);
+        return;
+    }
+
+    for (i = 0; i < n_requests; i++) {
+        BatchItem *item = g_slice_new (BatchItem);
+
+        item->task = g_object_ref (task);
+        item->index = i;
+
+        indicator_ipp_client_send_async (self, requests[i], resource, timeout_ms,
+                                         cancellable, batch_item_done, item);
+    }
+
+    g_object_unref (task);
+}
+
+
+/* Returns the responses of a batch as a GPtrArray of ipp_t, or NULL if the
+ * batch was cancelled.  Free it with g_ptr_array_unref(). */
+GPtrArray *
+indicator_ipp_client_send_all_finish (IndicatorIppClient *self,
+                                      GAsyncResult *result,
+                                      GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+
+/* Creates a Get-Jobs request for the current user's active jobs.  If printer
+ * is NULL, the jobs of all printers are requested. */
+ipp_t *
+indicator_ipp_new_get_jobs_request (const gchar *printer,
+                                    const char * const *attrs,
+                                    gint nattrs)
+{
+    ipp_t *req;
+    char uri[HTTP_MAX_URI];
+
+    if (printer)
+        httpAssembleURIf (HTTP_URI_CODING_ALL, uri, sizeof uri, "ipp", NULL,
+                          "localhost", ippPort (), "/printers/%s", printer);
+    else
+        strcpy (uri, "ipp://localhost/");
+
+    req = ippNewRequest (IPP_GET_JOBS);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "printer-uri", NULL, uri);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                  "requesting-user-name", NULL, cupsUser ());
+    ippAddBoolean (req, IPP_TAG_OPERATION, "my-jobs", 1);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                  "which-jobs", NULL, "not-completed");
+    if (attrs && nattrs > 0)
+        ippAddStrings (req, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                       "requested-attributes", nattrs, NULL, attrs);
+
+    return req;
+}
+
+
+ipp_t *
+indicator_ipp_new_get_printer_attributes_request (const gchar *printer,
+                                                  const char * const *attrs,
+                                                  gint nattrs)
+{
+    ipp_t *req;
+    char uri[HTTP_MAX_URI];
+
+    httpAssembleURIf (HTTP_URI_CODING_ALL, uri, sizeof uri, "ipp", NULL,
+                      "localhost", ippPort (), "/printers/%s", printer);
+
+    req = ippNewRequest (IPP_GET_PRINTER_ATTRIBUTES);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "printer-uri", NULL, uri);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                  "requesting-user-name", NULL, cupsUser ());
+    if (attrs && nattrs > 0)
+        ippAddStrings (req, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                       "requested-attributes", nattrs, NULL, attrs);
+
+    return req;
+}
+
+
+/* Returns the values of a keyword attribute separated by spaces, the same
+ * format the dbus notifier uses for printer-state-reasons. */
+gchar *
+indicator_ipp_join_keywords (ipp_attribute_t *attr)
+{
+    GString *str;
+    int i;
+
+    str = g_string_new ("");
+    for (i = 0; i < ippGetCount (attr); i++) {
+        if (i > 0)
+            g_string_append_c (str, ' ');
+        g_string_append (str, ippGetString (attr, i, NULL));
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+
+gint
+indicator_ipp_count_jobs (ipp_t *response)
+{
+    ipp_attribute_t *attr;
+    gint njobs = 0;
+
+    for (attr = ippFirstAttribute (response); attr; attr = ippNextAttribute (response)) {
+        if (ippGetGroupTag (attr) == IPP_TAG_JOB &&
+            g_strcmp0 (ippGetName (attr), "job-id") == 0)
+            njobs++;
+    }
+
+    return njobs;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_IPP_CLIENT_H
+#define INDICATOR_IPP_CLIENT_H
+
+#include <gio/gio.h>
+#include <cups/cups.h>
+
+G_BEGIN_DECLS
+
+#define INDICATOR_TYPE_IPP_CLIENT indicator_ipp_client_get_type()
+
+#define INDICATOR_IPP_CLIENT(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  INDICATOR_TYPE_IPP_CLIENT, IndicatorIppClient))
+
+#define INDICATOR_IPP_CLIENT_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  INDICATOR_TYPE_IPP_CLIENT, IndicatorIppClientClass))
+
+#define INDICATOR_IS_IPP_CLIENT(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  INDICATOR_TYPE_IPP_CLIENT))
+
+#define INDICATOR_IS_IPP_CLIENT_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  INDICATOR_TYPE_IPP_CLIENT))
+
+#define INDICATOR_IPP_CLIENT_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  INDICATOR_TYPE_IPP_CLIENT, IndicatorIppClientClass))
+
+/* timeout for requests which are not expected to take long */
+#define INDICATOR_IPP_DEFAULT_TIMEOUT 10000
+
+/* errors from cupsd; the error code is the ipp_status_t of the response */
+#define INDICATOR_IPP_ERROR indicator_ipp_error_quark ()
+
+typedef struct _IndicatorIppClient IndicatorIppClient;
+typedef struct _IndicatorIppClientClass IndicatorIppClientClass;
+typedef struct _IndicatorIppClientPrivate IndicatorIppClientPrivate;
+
+struct _IndicatorIppClient
+{
+  GObject parent;
+  IndicatorIppClientPrivate *priv;
+};
+
+struct _IndicatorIppClientClass
+{
+  GObjectClass parent_class;
+};
+
+GType indicator_ipp_client_get_type (void) G_GNUC_CONST;
+GQuark indicator_ipp_error_quark (void);
+
+IndicatorIppClient * indicator_ipp_client_new (guint max_connections);
+
+void indicator_ipp_client_send_async (IndicatorIppClient *self,
+                                      ipp_t *request,
+                                      const gchar *resource,
+                                      guint timeout_ms,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data);
+ipp_t * indicator_ipp_client_send_finish (IndicatorIppClient *self,
+                                          GAsyncResult *result,
+                                          GError **error);
+
+void indicator_ipp_client_send_all_async (IndicatorIppClient *self,
+                                          ipp_t **requests,
+                                          guint n_requests,
+                                          const gchar *resource,
+                                          guint timeout_ms,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data);
+GPtrArray * indicator_ipp_client_send_all_finish (IndicatorIppClient *self,
+                                                  GAsyncResult *result,
+                                                  GError **error);
+
+ipp_t * indicator_ipp_new_get_jobs_request (const gchar *printer,
+                                            const char * const *attrs,
+                                            gint nattrs);
+ipp_t * indicator_ipp_new_get_printer_attributes_request (const gchar *printer,
+                                                          const char * const *attrs,
+                                                          gint nattrs);
+gchar * indicator_ipp_join_keywords (ipp_attribute_t *attr);
+gint indicator_ipp_count_jobs (ipp_t *response);
+
+G_END_DECLS
+
+#endif
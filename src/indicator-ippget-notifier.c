@@ -0,0 +1,562 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-ippget-notifier.h"
+
+#include <cups/cups.h>
+
+
+G_DEFINE_TYPE (IndicatorIppgetNotifier, indicator_ippget_notifier, G_TYPE_OBJECT)
+
+
+/* Polls cupsd with Get-Notifications for the events of an ippget
+ * subscription and emits them on a CupsNotifier skeleton, with the same
+ * arguments cupsd's dbus notifier would send.  Everything that listens to
+ * a CupsNotifier proxy works unchanged on top of it.
+ *
+ * The poll interval drops to min-interval while events are coming in and
+ * doubles with every empty poll up to the interval suggested by cupsd
+ * (notify-get-interval), but never beyond max-interval. */
+
+
+typedef enum
+{
+    EVENT_JOB,
+    EVENT_PRINTER,
+    EVENT_SERVER
+} EventKind;
+
+
+/* notify-subscribed-event keyword -> CupsNotifier signal */
+static const struct {
+    const gchar *keyword;
+    const gchar *signal;
+    EventKind kind;
+} event_signals[] = {
+    { "job-created", "job-created", EVENT_JOB },
+    { "job-state-changed", "job-state", EVENT_JOB },
+    { "job-completed", "job-completed", EVENT_JOB },
+    { "printer-added", "printer-added", EVENT_PRINTER },
+    { "printer-deleted", "printer-deleted", EVENT_PRINTER },
+    { "printer-modified", "printer-modified", EVENT_PRINTER },
+    { "printer-restarted", "printer-restarted", EVENT_PRINTER },
+    { "printer-stopped", "printer-stopped", EVENT_PRINTER },
+    { "printer-shutdown", "printer-shutdown", EVENT_PRINTER },
+    { "printer-state-changed", "printer-state-changed", EVENT_PRINTER },
+    { "printer-finishings-changed", "printer-finishings-changed", EVENT_PRINTER },
+    { "printer-media-changed", "printer-media-changed", EVENT_PRINTER },
+    { "server-started", "server-started", EVENT_SERVER },
+    { "server-restarted", "server-restarted", EVENT_SERVER },
+    { "server-stopped", "server-stopped", EVENT_SERVER },
+    { "server-audit", "server-audit", EVENT_SERVER }
+};
+
+
+/* the attributes of one event notification; strings point into the
+ * response, except for the joined keywords */
+typedef struct
+{
+    const gchar *event;
+    gint sequence;
+    const gchar *text;
+    const gchar *printer_uri;
+    const gchar *printer_name;
+    guint printer_state;
+    gchar *printer_state_reasons;
+    gboolean printer_is_accepting_jobs;
+    guint job_id;
+    guint job_state;
+    gchar *job_state_reasons;
+    const gchar *job_name;
+    guint job_impressions_completed;
+} Event;
+
+
+struct _IndicatorIppgetNotifierPrivate
+{
+    IndicatorIppClient *ipp_client;
+    IndicatorCupsSubscription *subscription;
+    CupsNotifier *cups_notifier;
+
+    gint subscription_id;
+    gint next_sequence;         /* of the next event that wasn't fetched yet */
+
+    guint min_interval;
+    guint max_interval;
+    guint interval;             /* of the next poll, in milliseconds */
+    guint suggested_interval;
+    guint poll_id;
+
+    guint polls;
+    guint events;
+};
+
+
+enum {
+    PROP_0,
+    PROP_IPP_CLIENT,
+    PROP_SUBSCRIPTION,
+    PROP_MIN_INTERVAL,
+    PROP_MAX_INTERVAL,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *properties[NUM_PROPERTIES];
+
+
+enum {
+    EVENTS_LOST,
+    NUM_SIGNALS
+};
+
+static guint signals[NUM_SIGNALS];
+
+
+static gboolean poll_timeout (gpointer user_data);
+
+
+static void
+schedule_poll (IndicatorIppgetNotifier *self)
+{
+    if (self->priv->poll_id)
+        return;
+
+    self->priv->poll_id = g_timeout_add (self->priv->interval, poll_timeout, self);
+}
+
+
+static void
+emit_event (IndicatorIppgetNotifier *self,
+            Event *event)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (event_signals); i++) {
+        if (g_str_equal (event_signals[i].keyword, event->event))
+            break;
+    }
+    if (i == G_N_ELEMENTS (event_signals))
+        return;
+
+    switch (event_signals[i].kind)
+    {
+        case EVENT_JOB:
+            g_signal_emit_by_name (self->priv->cups_notifier, event_signals[i].signal,
+                                   event->text, event->printer_uri,
+                                   event->printer_name, event->printer_state,
+                                   event->printer_state_reasons,
+                                   event->printer_is_accepting_jobs,
+                                   event->job_id, event->job_state,
+                                   event->job_state_reasons, event->job_name,
+                                   event->job_impressions_completed);
+            break;
+
+        case EVENT_PRINTER:
+            g_signal_emit_by_name (self->priv->cups_notifier, event_signals[i].signal,
+                                   event->text, event->printer_uri,
+                                   event->printer_name, event->printer_state,
+                                   event->printer_state_reasons,
+                                   event->printer_is_accepting_jobs);
+            break;
+
+        case EVENT_SERVER:
+            g_signal_emit_by_name (self->priv->cups_notifier, event_signals[i].signal,
+                                   event->text);
+            break;
+    }
+}
+
+
+/* Emits the events of a Get-Notifications response in order and returns
+ * how many there were */
+static guint
+emit_events (IndicatorIppgetNotifier *self,
+             ipp_t *resp)
+{
+    ipp_attribute_t *attr;
+    guint n = 0;
+
+    for (attr = ippFirstAttribute (resp); attr; attr = ippNextAttribute (resp)) {
+        Event event = { 0 };
+
+        while (attr && ippGetGroupTag (attr) != IPP_TAG_EVENT_NOTIFICATION)
+            attr = ippNextAttribute (resp);
+
+        for (; attr && ippGetGroupTag (attr) == IPP_TAG_EVENT_NOTIFICATION;
+             attr = ippNextAttribute (resp)) {
+            const char *name = ippGetName (attr);
+
+            /* groups are separated by an unnamed attribute */
+            if (!name)
+                break;
+
+            if (g_str_equal (name, "notify-subscribed-event"))
+                event.event = ippGetString (attr, 0, NULL);
+            else if (g_str_equal (name, "notify-sequence-number"))
+                event.sequence = ippGetInteger (attr, 0);
+            else if (g_str_equal (name, "notify-text"))
+                event.text = ippGetString (attr, 0, NULL);
+            else if (g_str_equal (name, "notify-printer-uri"))
+                event.printer_uri = ippGetString (attr, 0, NULL);
+            else if (g_str_equal (name, "printer-name"))
+                event.printer_name = ippGetString (attr, 0, NULL);
+            else if (g_str_equal (name, "printer-state"))
+                event.printer_state = ippGetInteger (attr, 0);
+            else if (g_str_equal (name, "printer-state-reasons") && !event.printer_state_reasons)
+                event.printer_state_reasons = indicator_ipp_join_keywords (attr);
+            else if (g_str_equal (name, "printer-is-accepting-jobs"))
+                event.printer_is_accepting_jobs = ippGetBoolean (attr, 0);
+            else if (g_str_equal (name, "notify-job-id"))
+                event.job_id = ippGetInteger (attr, 0);
+            else if (g_str_equal (name, "job-state"))
+                event.job_state = ippGetInteger (attr, 0);
+            else if (g_str_equal (name, "job-state-reasons") && !event.job_state_reasons)
+                event.job_state_reasons = indicator_ipp_join_keywords (attr);
+            else if (g_str_equal (name, "job-name"))
+                event.job_name = ippGetString (attr, 0, NULL);
+            else if (g_str_equal (name, "job-impressions-completed"))
+                event.job_impressions_completed = ippGetInteger (attr, 0);
+        }
+
+        if (event.event && event.sequence >= self->priv->next_sequence) {
+            /* cupsd only keeps a limited number of events per subscription */
+            if (event.sequence > self->priv->next_sequence && self->priv->next_sequence > 1) {
+                g_debug ("events %d to %d of subscription %d expired",
+                         self->priv->next_sequence, event.sequence - 1,
+                         self->priv->subscription_id);
+                g_signal_emit (self, signals[EVENTS_LOST], 0);
+            }
+            self->priv->next_sequence = event.sequence + 1;
+
+            if (!event.text)
+                event.text = "";
+            if (!event.printer_uri)
+                event.printer_uri = "";
+            if (!event.printer_name)
+                event.printer_name = "";
+            if (!event.printer_state_reasons)
+                event.printer_state_reasons = g_strdup ("");
+            if (!event.job_state_reasons)
+                event.job_state_reasons = g_strdup ("");
+            if (!event.job_name)
+                event.job_name = "";
+
+            emit_event (self, &event);
+            n++;
+        }
+
+        g_free (event.printer_state_reasons);
+        g_free (event.job_state_reasons);
+
+        if (!attr)
+            break;
+    }
+
+    return n;
+}
+
+
+static void
+got_notifications (GObject *source_object,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+    IndicatorIppgetNotifier *self = INDICATOR_IPPGET_NOTIFIER (user_data);
+    ipp_t *resp;
+    ipp_attribute_t *attr;
+    guint n;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+
+    /* disposed while waiting for the reply */
+    if (!self->priv->ipp_client) {
+        if (resp)
+            ippDelete (resp);
+        g_clear_error (&error);
+        goto out;
+    }
+
+    if (!resp) {
+        g_warning ("Error getting CUPS notifications: %s", error->message);
+
+        /* cupsd forgot about the subscription */
+        if (g_error_matches (error, INDICATOR_IPP_ERROR, IPP_NOT_FOUND))
+            indicator_cups_subscription_renew (self->priv->subscription);
+
+        g_error_free (error);
+        self->priv->interval = self->priv->max_interval;
+        schedule_poll (self);
+        goto out;
+    }
+
+    attr = ippFindAttribute (resp, "notify-get-interval", IPP_TAG_INTEGER);
+    if (attr)
+        self->priv->suggested_interval = CLAMP (ippGetInteger (attr, 0) * 1000,
+                                                self->priv->min_interval,
+                                                self->priv->max_interval);
+
+    n = emit_events (self, resp);
+    if (n > 0) {
+        self->priv->events += n;
+        self->priv->interval = self->priv->min_interval;
+    }
+    else {
+        self->priv->interval = MIN (self->priv->interval * 2,
+                                    self->priv->suggested_interval);
+    }
+
+    ippDelete (resp);
+    schedule_poll (self);
+
+out:
+    g_object_unref (self);
+}
+
+
+static gboolean
+poll_timeout (gpointer user_data)
+{
+    IndicatorIppgetNotifier *self = INDICATOR_IPPGET_NOTIFIER (user_data);
+    ipp_t *req;
+    gint id;
+
+    self->priv->poll_id = 0;
+
+    /* wait for the subscription to be created */
+    id = indicator_cups_subscription_get_id (self->priv->subscription);
+    if (id <= 0) {
+        self->priv->interval = self->priv->suggested_interval;
+        schedule_poll (self);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (id != self->priv->subscription_id) {
+        self->priv->subscription_id = id;
+        self->priv->next_sequence = 1;
+    }
+
+    req = ippNewRequest (IPP_GET_NOTIFICATIONS);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "printer-uri", NULL, "/");
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                  "requesting-user-name", NULL, cupsUser ());
+    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                   "notify-subscription-ids", id);
+    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                   "notify-sequence-numbers", self->priv->next_sequence);
+    ippAddBoolean (req, IPP_TAG_OPERATION, "notify-wait", 0);
+
+    self->priv->polls++;
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     got_notifications, g_object_ref (self));
+
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+get_property (GObject    *object,
+              guint       property_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+    IndicatorIppgetNotifier *self = INDICATOR_IPPGET_NOTIFIER (object);
+
+    switch (property_id)
+    {
+        case PROP_IPP_CLIENT:
+            g_value_set_object (value, self->priv->ipp_client);
+            break;
+
+        case PROP_SUBSCRIPTION:
+            g_value_set_object (value, self->priv->subscription);
+            break;
+
+        case PROP_MIN_INTERVAL:
+            g_value_set_uint (value, self->priv->min_interval);
+            break;
+
+        case PROP_MAX_INTERVAL:
+            g_value_set_uint (value, self->priv->max_interval);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+set_property (GObject      *object,
+              guint         property_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    IndicatorIppgetNotifier *self = INDICATOR_IPPGET_NOTIFIER (object);
+
+    switch (property_id)
+    {
+        case PROP_IPP_CLIENT:
+            self->priv->ipp_client = g_value_dup_object (value);
+            break;
+
+        case PROP_SUBSCRIPTION:
+            self->priv->subscription = g_value_dup_object (value);
+            break;
+
+        case PROP_MIN_INTERVAL:
+            self->priv->min_interval = MAX (g_value_get_uint (value), 1);
+            break;
+
+        case PROP_MAX_INTERVAL:
+            self->priv->max_interval = MAX (g_value_get_uint (value), 1);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+constructed (GObject *object)
+{
+    IndicatorIppgetNotifier *self = INDICATOR_IPPGET_NOTIFIER (object);
+
+    self->priv->max_interval = MAX (self->priv->max_interval, self->priv->min_interval);
+    self->priv->suggested_interval = self->priv->max_interval;
+    self->priv->interval = self->priv->min_interval;
+    schedule_poll (self);
+
+    G_OBJECT_CLASS (indicator_ippget_notifier_parent_class)->constructed (object);
+}
+
+
+static void
+dispose (GObject *object)
+{
+    IndicatorIppgetNotifier *self = INDICATOR_IPPGET_NOTIFIER (object);
+
+    if (self->priv->poll_id) {
+        g_source_remove (self->priv->poll_id);
+        self->priv->poll_id = 0;
+    }
+    g_clear_object (&self->priv->cups_notifier);
+    g_clear_object (&self->priv->subscription);
+    g_clear_object (&self->priv->ipp_client);
+
+    G_OBJECT_CLASS (indicator_ippget_notifier_parent_class)->dispose (object);
+}
+
+
+static void
+indicator_ippget_notifier_class_init (IndicatorIppgetNotifierClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (IndicatorIppgetNotifierPrivate));
+
+    object_class->get_property = get_property;
+    object_class->set_property = set_property;
+    object_class->constructed = constructed;
+    object_class->dispose = dispose;
+
+    properties[PROP_IPP_CLIENT] = g_param_spec_object ("ipp-client",
+                                                       "IPP Client",
+                                                       "Client used for requests to cupsd",
+                                                       INDICATOR_TYPE_IPP_CLIENT,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_SUBSCRIPTION] = g_param_spec_object ("subscription",
+                                                         "Subscription",
+                                                         "The ippget subscription whose events are fetched",
+                                                         INDICATOR_TYPE_CUPS_SUBSCRIPTION,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_MIN_INTERVAL] = g_param_spec_uint ("min-interval",
+                                                       "Minimum Interval",
+                                                       "Milliseconds between polls while events are coming in",
+                                                       1, G_MAXUINT, 1000,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_MAX_INTERVAL] = g_param_spec_uint ("max-interval",
+                                                       "Maximum Interval",
+                                                       "Milliseconds between polls when nothing happens",
+                                                       1, G_MAXUINT, 30000,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT_ONLY);
+
+    g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
+
+    /* events were dropped by cupsd before they were fetched */
+    signals[EVENTS_LOST] = g_signal_new ("events-lost",
+                                         INDICATOR_TYPE_IPPGET_NOTIFIER,
+                                         G_SIGNAL_RUN_FIRST,
+                                         0,
+                                         NULL, NULL,
+                                         g_cclosure_marshal_VOID__VOID,
+                                         G_TYPE_NONE, 0);
+}
+
+
+static void
+indicator_ippget_notifier_init (IndicatorIppgetNotifier *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              INDICATOR_TYPE_IPPGET_NOTIFIER,
+                                              IndicatorIppgetNotifierPrivate);
+
+    self->priv->cups_notifier = cups_notifier_skeleton_new ();
+}
+
+
+IndicatorIppgetNotifier *
+indicator_ippget_notifier_new (IndicatorIppClient *ipp_client,
+                               IndicatorCupsSubscription *subscription)
+{
+    return g_object_new (INDICATOR_TYPE_IPPGET_NOTIFIER,
+                         "ipp-client", ipp_client,
+                         "subscription", subscription,
+                         NULL);
+}
+
+
+/* Returns the object on which the fetched events are emitted */
+CupsNotifier *
+indicator_ippget_notifier_get_cups_notifier (IndicatorIppgetNotifier *self)
+{
+    return self->priv->cups_notifier;
+}
+
+
+void
+indicator_ippget_notifier_get_poll_stats (IndicatorIppgetNotifier *self,
+                                          guint *polls,
+                                          guint *events)
+{
+    if (polls)
+        *polls = self->priv->polls;
+    if (events)
+        *events = self->priv->events;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_IPPGET_NOTIFIER_H
+#define INDICATOR_IPPGET_NOTIFIER_H
+
+#include <glib-object.h>
+
+#include "cups-notifier.h"
+#include "indicator-cups-subscription.h"
+#include "indicator-ipp-client.h"
+
+G_BEGIN_DECLS
+
+#define INDICATOR_TYPE_IPPGET_NOTIFIER indicator_ippget_notifier_get_type()
+
+#define INDICATOR_IPPGET_NOTIFIER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  INDICATOR_TYPE_IPPGET_NOTIFIER, IndicatorIppgetNotifier))
+
+#define INDICATOR_IPPGET_NOTIFIER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  INDICATOR_TYPE_IPPGET_NOTIFIER, IndicatorIppgetNotifierClass))
+
+#define INDICATOR_IS_IPPGET_NOTIFIER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  INDICATOR_TYPE_IPPGET_NOTIFIER))
+
+#define INDICATOR_IS_IPPGET_NOTIFIER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  INDICATOR_TYPE_IPPGET_NOTIFIER))
+
+#define INDICATOR_IPPGET_NOTIFIER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  INDICATOR_TYPE_IPPGET_NOTIFIER, IndicatorIppgetNotifierClass))
+
+typedef struct _IndicatorIppgetNotifier IndicatorIppgetNotifier;
+typedef struct _IndicatorIppgetNotifierClass IndicatorIppgetNotifierClass;
+typedef struct _IndicatorIppgetNotifierPrivate IndicatorIppgetNotifierPrivate;
+
+struct _IndicatorIppgetNotifier
+{
+  GObject parent;
+  IndicatorIppgetNotifierPrivate *priv;
+};
+
+struct _IndicatorIppgetNotifierClass
+{
+  GObjectClass parent_class;
+};
+
+GType indicator_ippget_notifier_get_type (void) G_GNUC_CONST;
+
+IndicatorIppgetNotifier * indicator_ippget_notifier_new (IndicatorIppClient *ipp_client,
+                                                         IndicatorCupsSubscription *subscription);
+CupsNotifier * indicator_ippget_notifier_get_cups_notifier (IndicatorIppgetNotifier *self);
+void indicator_ippget_notifier_get_poll_stats (IndicatorIppgetNotifier *self,
+                                               guint *polls,
+                                               guint *events);
+
+G_END_DECLS
+
+#endif
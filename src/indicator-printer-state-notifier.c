@@ -19,16 +19,18 @@
 #include "indicator-printer-state-notifier.h"
 
 #include <glib/gi18n.h>
-#include <gtk/gtk.h>
-#include <cups/cups.h>
+#include <gmodule.h>
 #include <string.h>
-#include <stdarg.h>
 
-#include "cups-notifier.h"
+#include "alert-dialog.h"
+#include "notified-state.h"
+#include "printer-state-reasons.h"
 #include "spawn-printer-settings.h"
 
 
-#define RESPONSE_SHOW_SYSTEM_SETTINGS 1
+#define NOTIFICATIONS_DBUS_NAME "org.freedesktop.Notifications"
+#define NOTIFICATIONS_DBUS_PATH "/org/freedesktop/Notifications"
+#define NOTIFICATIONS_DBUS_INTERFACE "org.freedesktop.Notifications"
 
 
 G_DEFINE_TYPE (IndicatorPrinterStateNotifier, indicator_printer_state_notifier, G_TYPE_OBJECT)
@@ -36,19 +38,70 @@ G_DEFINE_TYPE (IndicatorPrinterStateNotifier, indicator_printer_state_notifier,
 
 struct _IndicatorPrinterStateNotifierPrivate
 {
-    CupsNotifier *cups_notifier;
+    IndicatorPrintersStore *store;
+
+    /* printers whose job count a lazy store is refreshing for an alert */
+    GHashTable *awaiting_jobs;
+
+    /* printer states that were already notified about; persists across
+     * restarts of the service */
+    NotifiedState *notified_printer_states;
+
+    /* user visible strings with a %s for printer name, for each of the well
+     * known state reasons */
+    const gchar *printer_alerts[PRINTER_STATE_N_KNOWN_REASONS];
+
+    /* printer name -> Alert that is currently shown */
+    GHashTable *alerts;
+
+    /* the dialog module, loaded from module_dir when the first dialog is
+     * shown */
+    gchar *module_dir;
+    const AlertDialogFuncs *dialogs;
+
+    /* with the notification backend, all alerts are shown in one desktop
+     * notification, which is sent at most every notification_interval
+     * milliseconds and replaces the previous one */
+    gboolean use_notifications;
+    guint notification_interval;
+    guint notification_flush_id;
+    guint32 notification_id;
+    gboolean notification_sending;
+    gboolean notification_queued;
+    GDBusConnection *session_bus;
+    gboolean session_bus_pending;
+    guint notification_closed_id;
+    guint action_invoked_id;
+
+    /* each printer and reason may raise up to alert_burst alerts at once and
+     * regains one every alert_cooldown seconds */
+    guint alert_cooldown;
+    guint alert_burst;
+    guint alerts_shown;
+    guint alerts_suppressed;
+};
 
-    /* printer states that were already notified about in this session */
-    GHashTable *notified_printer_states;
 
-    /* state-reason -> user visible string with a %s for printer name */
-    GHashTable *printer_alerts;
-};
+/* the dialog for a printer (or its part of the notification), which lists
+ * all of its reasons that were raised since it was opened */
+typedef struct
+{
+    IndicatorPrinterStateNotifier *notifier;
+    gchar *printer;
+    gpointer dialog;            /* NULL with the notification backend */
+    PrinterStateReasons reasons;
+    int njobs;
+} Alert;
 
 
 enum {
     PROP_0,
-    PROP_CUPS_NOTIFIER,
+    PROP_STORE,
+    PROP_ALERT_COOLDOWN,
+    PROP_ALERT_BURST,
+    PROP_ALERT_BACKEND,
+    PROP_NOTIFICATION_INTERVAL,
+    PROP_MODULE_DIR,
     NUM_PROPERTIES
 };
 
@@ -56,134 +109,567 @@ GParamSpec *properties[NUM_PROPERTIES];
 
 
 static void
-g_hash_table_insert_many (GHashTable *hash_table,
-                          gpointer key,
-                          ...)
+alert_free (Alert *alert)
 {
-    va_list args;
+    if (alert->dialog)
+        alert->notifier->priv->dialogs->destroy (alert->dialog);
+    g_free (alert->printer);
+    g_slice_free (Alert, alert);
+}
 
-    va_start (args, key);
-    while (key) {
-        gpointer value = va_arg (args, gpointer);
-        g_hash_table_insert (hash_table, key, value);
-        key = va_arg (args, gpointer);
-    }
-    va_end (args);
+
+static void
+on_alert_response (gboolean show_settings,
+                   gpointer user_data)
+{
+    Alert *alert = user_data;
+
+    if (show_settings)
+        spawn_printer_settings ();
+
+    /* destroys the dialog */
+    g_hash_table_remove (alert->notifier->priv->alerts, alert->printer);
 }
 
 
-/* returns a list of strings that are in a but not in b; does not copy the
- * strings */
-static GList *
-g_strv_diff (gchar **a,
-             gchar **b)
+/* appends a line for each of alert's reasons to text */
+static void
+append_alert_text (GString *text,
+                   Alert *alert)
 {
-    GList *result = NULL;
-    gchar **p;
+    IndicatorPrinterStateNotifierPrivate *priv = alert->notifier->priv;
+    guint i;
 
-    if (!a)
-        return NULL;
+    for (i = 0; i < PRINTER_STATE_N_KNOWN_REASONS; i++) {
+        if (!PRINTER_STATE_REASONS_HAS (alert->reasons, i) || !priv->printer_alerts[i])
+            continue;
 
-    for (p = a; *p; p++) {
-        if (!g_strv_contains ((const gchar * const *) b, *p))
-            result = g_list_prepend (result, *p);
+        if (text->len > 0)
+            g_string_append_c (text, '\n');
+        g_string_append_printf (text, priv->printer_alerts[i], alert->printer);
     }
-
-    return g_list_reverse (result);
 }
 
 
-void
-show_alert_box (const gchar *printer,
-                const gchar *reason,
-                int njobs)
+static void
+update_alert_text (Alert *alert,
+                   int njobs)
 {
-    GtkWidget *dialog;
-    GtkWidget *image;
-    gchar *primary_text;
+    GString *primary_text;
     gchar *secondary_text;
 
-    image = gtk_image_new_from_icon_name ("printer", GTK_ICON_SIZE_DIALOG);
-    primary_text = g_strdup_printf (reason, printer);
+    primary_text = g_string_new ("");
+    append_alert_text (primary_text, alert);
 
     secondary_text = g_strdup_printf (ngettext(
                    "You have %d job queued to print on this printer.", 
                    "You have %d jobs queued to print on this printer.", njobs),
                    njobs);
 
-    dialog = g_object_new (GTK_TYPE_MESSAGE_DIALOG,
-                           "title", _("Printing Problem"),
-                           "icon-name", "printer",
-                           "image", image,
-                           "text", primary_text,
-                           "secondary-text", secondary_text,
-                           "urgency-hint", TRUE,
-                           "focus-on-map", FALSE,
-                           "window-position", GTK_WIN_POS_CENTER,
-                           "skip-taskbar-hint", FALSE,
-                           "deletable", FALSE,
-                           NULL);
-
-    g_free (primary_text);
+    alert->notifier->priv->dialogs->set_text (alert->dialog,
+                                              primary_text->str,
+                                              secondary_text);
+
+    g_string_free (primary_text, TRUE);
     g_free (secondary_text);
+}
+
+
+static void flush_notification (IndicatorPrinterStateNotifier *self);
+static gboolean load_alert_dialogs (IndicatorPrinterStateNotifier *self);
+
+
+/* There is no notification daemon in this session: the alerts that were
+ * waiting for it, and all later ones, are shown as dialogs */
+static void
+fall_back_to_dialogs (IndicatorPrinterStateNotifier *self)
+{
+    GHashTableIter iter;
+    Alert *alert;
+
+    self->priv->use_notifications = FALSE;
+    self->priv->notification_queued = FALSE;
+    if (self->priv->notification_flush_id) {
+        g_source_remove (self->priv->notification_flush_id);
+        self->priv->notification_flush_id = 0;
+    }
+
+    g_hash_table_iter_init (&iter, self->priv->alerts);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &alert)) {
+        alert->dialog = self->priv->dialogs->create (on_alert_response, alert);
+        update_alert_text (alert, alert->njobs);
+    }
+}
+
 
-    gtk_dialog_add_buttons (GTK_DIALOG (dialog),
-                            _("_Settings…"), RESPONSE_SHOW_SYSTEM_SETTINGS,
-                            GTK_STOCK_OK, GTK_RESPONSE_OK,
-                            NULL);
-    gtk_dialog_set_default_response (GTK_DIALOG (dialog),
-                                     GTK_RESPONSE_OK);
-    gtk_widget_show_all (dialog);
+static void
+on_notification_closed (GDBusConnection *connection,
+                        const gchar *sender_name,
+                        const gchar *object_path,
+                        const gchar *interface_name,
+                        const gchar *signal_name,
+                        GVariant *parameters,
+                        gpointer user_data)
+{
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+    guint32 id;
+
+    g_variant_get (parameters, "(u*)", &id, NULL);
+    if (id == 0 || id != self->priv->notification_id)
+        return;
+
+    /* the next alert starts a new notification */
+    self->priv->notification_id = 0;
+    g_hash_table_remove_all (self->priv->alerts);
+}
 
-    if (gtk_dialog_run (GTK_DIALOG (dialog)) == RESPONSE_SHOW_SYSTEM_SETTINGS)
+
+static void
+on_action_invoked (GDBusConnection *connection,
+                   const gchar *sender_name,
+                   const gchar *object_path,
+                   const gchar *interface_name,
+                   const gchar *signal_name,
+                   GVariant *parameters,
+                   gpointer user_data)
+{
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+    guint32 id;
+
+    g_variant_get (parameters, "(u*)", &id, NULL);
+    if (id != 0 && id == self->priv->notification_id)
         spawn_printer_settings ();
+}
+
 
-    gtk_widget_destroy (dialog);
+static void
+notification_sent (GObject *source_object,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+    GVariant *reply;
+    GError *error = NULL;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                           result, &error);
+    if (reply) {
+        g_variant_get (reply, "(u)", &self->priv->notification_id);
+        g_variant_unref (reply);
+    }
+    else if ((g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+              g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER)) &&
+             load_alert_dialogs (self)) {
+        g_debug ("No notification daemon, showing printer alerts as dialogs");
+        g_error_free (error);
+        fall_back_to_dialogs (self);
+    }
+    else {
+        g_warning ("Error sending printer notification: %s", error->message);
+        g_error_free (error);
+    }
+
+    self->priv->notification_sending = FALSE;
+
+    /* alerts that arrived in the meantime needed the id of this notification
+     * to replace it */
+    if (self->priv->notification_queued && self->priv->alerts) {
+        self->priv->notification_queued = FALSE;
+        flush_notification (self);
+    }
+
+    g_object_unref (self);
 }
 
 
 static void
-on_printer_state_changed (CupsNotifier *object,
-                          const gchar *text,
-                          const gchar *printer_uri,
-                          const gchar *printer,
-                          guint printer_state,
-                          const gchar *printer_state_reasons,
-                          gboolean printer_is_accepting_jobs,
-                          gpointer user_data)
+got_session_bus (GObject *source_object,
+                 GAsyncResult *result,
+                 gpointer user_data)
 {
-    IndicatorPrinterStateNotifierPrivate *priv = INDICATOR_PRINTER_STATE_NOTIFIER (user_data)->priv;
-    int njobs;
-    cups_job_t *jobs;
-    gchar **state_reasons, **already_notified;
-    GList *new_state_reasons, *it;
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+    IndicatorPrinterStateNotifierPrivate *priv = self->priv;
+    GError *error = NULL;
+
+    priv->session_bus_pending = FALSE;
+
+    priv->session_bus = g_bus_get_finish (result, &error);
+    if (!priv->session_bus) {
+        /* tried again with the next alert */
+        g_warning ("Error connecting to the session bus: %s", error->message);
+        g_error_free (error);
+        priv->notification_queued = FALSE;
+        goto out;
+    }
+
+    priv->notification_closed_id =
+        g_dbus_connection_signal_subscribe (priv->session_bus,
+                                            NOTIFICATIONS_DBUS_NAME,
+                                            NOTIFICATIONS_DBUS_INTERFACE,
+                                            "NotificationClosed",
+                                            NOTIFICATIONS_DBUS_PATH,
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            on_notification_closed,
+                                            self, NULL);
+    priv->action_invoked_id =
+        g_dbus_connection_signal_subscribe (priv->session_bus,
+                                            NOTIFICATIONS_DBUS_NAME,
+                                            NOTIFICATIONS_DBUS_INTERFACE,
+                                            "ActionInvoked",
+                                            NOTIFICATIONS_DBUS_PATH,
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            on_action_invoked,
+                                            self, NULL);
+
+    if (priv->notification_queued && priv->alerts) {
+        priv->notification_queued = FALSE;
+        flush_notification (self);
+    }
+
+out:
+    g_object_unref (self);
+}
+
+
+static gboolean
+flush_notification_timeout (gpointer user_data)
+{
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+
+    self->priv->notification_flush_id = 0;
+    flush_notification (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+
+/* Sends one notification with the reasons of all printers, replacing the one
+ * that was sent before */
+static void
+flush_notification (IndicatorPrinterStateNotifier *self)
+{
+    IndicatorPrinterStateNotifierPrivate *priv = self->priv;
+    GHashTableIter iter;
+    Alert *alert;
+    GString *body;
+    GVariantBuilder actions, hints;
+
+    if (priv->notification_sending) {
+        /* sent once the reply has arrived */
+        priv->notification_queued = TRUE;
+        return;
+    }
+
+    if (!priv->session_bus) {
+        /* sent once the connection is there */
+        priv->notification_queued = TRUE;
+        if (!priv->session_bus_pending) {
+            priv->session_bus_pending = TRUE;
+            g_bus_get (G_BUS_TYPE_SESSION, NULL, got_session_bus, g_object_ref (self));
+        }
+        return;
+    }
+
+    body = g_string_new ("");
+    g_hash_table_iter_init (&iter, priv->alerts);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &alert))
+        append_alert_text (body, alert);
+
+    g_variant_builder_init (&actions, G_VARIANT_TYPE_STRING_ARRAY);
+    g_variant_builder_add (&actions, "s", "default");
+    g_variant_builder_add (&actions, "s", _("Settings…"));
+
+    g_variant_builder_init (&hints, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&hints, "{sv}", "urgency", g_variant_new_byte (1));
+
+    priv->notification_sending = TRUE;
+    g_dbus_connection_call (priv->session_bus,
+                            NOTIFICATIONS_DBUS_NAME,
+                            NOTIFICATIONS_DBUS_PATH,
+                            NOTIFICATIONS_DBUS_INTERFACE,
+                            "Notify",
+                            g_variant_new ("(susssasa{sv}i)",
+                                           "indicator-printers",
+                                           priv->notification_id,
+                                           "printer",
+                                           _("Printing Problem"),
+                                           body->str,
+                                           &actions,
+                                           &hints,
+                                           -1),
+                            G_VARIANT_TYPE ("(u)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1, NULL,
+                            notification_sent,
+                            g_object_ref (self));
+
+    g_string_free (body, TRUE);
+}
+
+
+/* Adds reasons for printer to the next notification */
+static void
+queue_notification (IndicatorPrinterStateNotifier *self,
+                    const gchar *printer,
+                    PrinterStateReasons reasons,
+                    int njobs)
+{
+    Alert *alert;
+
+    alert = g_hash_table_lookup (self->priv->alerts, printer);
+    if (!alert) {
+        alert = g_slice_new0 (Alert);
+        alert->notifier = self;
+        alert->printer = g_strdup (printer);
+        g_hash_table_insert (self->priv->alerts, alert->printer, alert);
+    }
+    alert->reasons |= reasons;
+    alert->njobs = njobs;
+
+    if (self->priv->notification_flush_id == 0)
+        self->priv->notification_flush_id =
+            g_timeout_add (self->priv->notification_interval,
+                           flush_notification_timeout, self);
+}
+
+
+/* Loads the dialog module, which initializes GTK.  Returns FALSE if that
+ * isn't possible, e.g. because the session has no display. */
+static gboolean
+load_alert_dialogs (IndicatorPrinterStateNotifier *self)
+{
+    GModule *module;
+    AlertDialogGetFuncs get_funcs;
+    gchar *path;
+
+    if (self->priv->dialogs)
+        return TRUE;
+
+    path = g_module_build_path (self->priv->module_dir, ALERT_DIALOG_MODULE_NAME);
+    module = g_module_open (path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+    if (!module) {
+        g_warning ("Could not load %s: %s", path, g_module_error ());
+        g_free (path);
+        return FALSE;
+    }
+    g_free (path);
+
+    if (!g_module_symbol (module, ALERT_DIALOG_MODULE_SYMBOL, (gpointer *) &get_funcs)) {
+        g_warning ("Could not load alert dialogs: %s", g_module_error ());
+        g_module_close (module);
+        return FALSE;
+    }
+
+    /* GTK can't be unloaded once it was initialized */
+    g_module_make_resident (module);
+
+    self->priv->dialogs = get_funcs ();
+    if (!self->priv->dialogs) {
+        g_warning ("Could not initialize GTK for alert dialogs");
+        return FALSE;
+    }
+
+    return TRUE;
+}
 
-    njobs = cupsGetJobs (&jobs, printer, 1, CUPS_WHICHJOBS_ACTIVE);
-    cupsFreeJobs (njobs, jobs);
+
+/* Shows reasons for printer without waiting for the user.  All reasons of a
+ * printer go into one dialog: if one is already open, the new reasons are
+ * added to it. */
+static void
+show_alert (IndicatorPrinterStateNotifier *self,
+            const gchar *printer,
+            PrinterStateReasons reasons,
+            int njobs)
+{
+    Alert *alert;
+
+    /* fall back to notifications for good */
+    if (!self->priv->use_notifications && !load_alert_dialogs (self))
+        self->priv->use_notifications = TRUE;
+
+    if (self->priv->use_notifications) {
+        queue_notification (self, printer, reasons, njobs);
+        return;
+    }
+
+    alert = g_hash_table_lookup (self->priv->alerts, printer);
+    if (alert) {
+        alert->reasons |= reasons;
+        alert->njobs = njobs;
+        update_alert_text (alert, njobs);
+        return;
+    }
+
+    alert = g_slice_new0 (Alert);
+    alert->notifier = self;
+    alert->printer = g_strdup (printer);
+    alert->reasons = reasons;
+    alert->njobs = njobs;
+    alert->dialog = self->priv->dialogs->create (on_alert_response, alert);
+
+    g_hash_table_insert (self->priv->alerts, alert->printer, alert);
+    update_alert_text (alert, njobs);
+}
+
+
+static gboolean
+take_alert_token (IndicatorPrinterStateNotifier *self,
+                  NotifiedStateEntry *entry,
+                  guint reason,
+                  gint64 now)
+{
+    NotifiedStateBucket *bucket = &entry->buckets[reason];
+    gdouble burst = self->priv->alert_burst;
+    gdouble tokens;
+
+    if (bucket->updated == 0 || self->priv->alert_cooldown == 0) {
+        tokens = burst;
+    }
+    else {
+        gint64 elapsed = MAX (now - bucket->updated, 0);
+        tokens = bucket->tokens +
+                 (gdouble) elapsed / (self->priv->alert_cooldown * (gdouble) G_USEC_PER_SEC);
+        tokens = MIN (tokens, burst);
+    }
+
+    bucket->updated = now;
+
+    if (tokens < 1.0) {
+        bucket->tokens = tokens;
+        return FALSE;
+    }
+
+    bucket->tokens = tokens - 1.0;
+    return TRUE;
+}
+
+
+static void
+notify_state_change (IndicatorPrinterStateNotifier *self,
+                     const gchar *printer,
+                     const gchar *printer_state_reasons,
+                     int njobs)
+{
+    IndicatorPrinterStateNotifierPrivate *priv = self->priv;
+    PrinterStateReasons state_reasons, raised;
+    NotifiedStateEntry *already_notified;
+    PrinterStateReasons alerts = 0;
+    gint64 now;
+    guint i;
 
     /* don't show any events if the current user does not have jobs queued on
      * that printer or this printer is unknown to CUPS */
     if (njobs <= 0)
         return;
 
-    state_reasons = g_strsplit (printer_state_reasons, " ", 0);
-    already_notified = g_hash_table_lookup (priv->notified_printer_states,
-                                            printer);
+    state_reasons = printer_state_reasons_parse (printer_state_reasons);
+
+    already_notified = notified_state_lookup (priv->notified_printer_states, printer);
+
+    raised = (state_reasons ^ already_notified->reasons) & state_reasons;
+    already_notified->reasons = state_reasons;
+
+    if (!raised)
+        return;
+
+    now = g_get_real_time ();
+    for (i = 0; i < PRINTER_STATE_N_KNOWN_REASONS; i++) {
+        if (!PRINTER_STATE_REASONS_HAS (raised, i) || !priv->printer_alerts[i])
+            continue;
 
-    new_state_reasons = g_strv_diff (state_reasons, already_notified);
+        /* the reason is toggling */
+        if (!take_alert_token (self, already_notified, i, now)) {
+            priv->alerts_suppressed++;
+            continue;
+        }
 
-    for (it = new_state_reasons; it; it = g_list_next (new_state_reasons)) {
-        const gchar *reason_text = g_hash_table_lookup (priv->printer_alerts,
-                                                        it->data);
-        if (reason_text)
-            show_alert_box (printer, reason_text, njobs);
+        alerts |= G_GUINT64_CONSTANT (1) << i;
+        priv->alerts_shown++;
     }
 
-    g_list_free (new_state_reasons);
+    if (alerts) {
+        already_notified->last_alert = now;
+        show_alert (self, printer, alerts, njobs);
+    }
+}
 
-    g_hash_table_replace (priv->notified_printer_states,
-                          g_strdup (printer),
-                          state_reasons);
+
+/* Whether printer_state_reasons raises a reason that an alert is shown for.
+ * Reasons that were cleared are forgotten, so that they are noticed again
+ * when they come back. */
+static gboolean
+raises_alert (IndicatorPrinterStateNotifier *self,
+              const gchar *printer,
+              const gchar *printer_state_reasons)
+{
+    PrinterStateReasons state_reasons, raised;
+    NotifiedStateEntry *already_notified;
+    guint i;
+
+    state_reasons = printer_state_reasons_parse (printer_state_reasons);
+
+    raised = state_reasons;
+    already_notified = notified_state_find (self->priv->notified_printer_states, printer);
+    if (already_notified) {
+        already_notified->reasons &= state_reasons;
+        raised &= ~already_notified->reasons;
+    }
+
+    for (i = 0; i < PRINTER_STATE_N_KNOWN_REASONS; i++) {
+        if (PRINTER_STATE_REASONS_HAS (raised, i) && self->priv->printer_alerts[i])
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/* The store already has the printer's state and the number of the user's
+ * jobs, which the menu shows as well.  Only a lazy store doesn't keep the
+ * job count current.  The store is asked to refresh the printer then, but
+ * only if an alert might be shown, and the alert waits for the
+ * printer-changed that brings the count. */
+static void
+on_printer_changed (IndicatorPrintersStore *store,
+                    const gchar *printer,
+                    gpointer user_data)
+{
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+    const gchar *printer_state_reasons;
+    const gchar *printers[] = { printer, NULL };
+
+    printer_state_reasons = indicator_printers_store_get_printer_state_reasons (store, printer);
+
+    /* also takes the count after a refresh that couldn't get the jobs,
+     * rather than asking again */
+    if (!indicator_printers_store_get_lazy (store) ||
+        indicator_printers_store_get_njobs_current (store, printer) ||
+        g_hash_table_remove (self->priv->awaiting_jobs, printer)) {
+        notify_state_change (self, printer, printer_state_reasons,
+                             indicator_printers_store_get_njobs (store, printer));
+        return;
+    }
+
+    if (!raises_alert (self, printer, printer_state_reasons))
+        return;
+
+    g_hash_table_add (self->priv->awaiting_jobs, g_strdup (printer));
+    indicator_printers_store_refresh_printers (store, printers);
+}
+
+
+/* a printer that is added again under the same name starts over */
+static void
+on_printer_removed (IndicatorPrintersStore *store,
+                    const gchar *printer,
+                    gpointer user_data)
+{
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (user_data);
+
+    notified_state_remove (self->priv->notified_printer_states, printer);
 }
 
 
@@ -197,9 +683,29 @@ get_property (GObject    *object,
 
     switch (property_id)
     {
-        case PROP_CUPS_NOTIFIER:
+        case PROP_STORE:
             g_value_set_object (value,
-                                indicator_printer_state_notifier_get_cups_notifier (self));
+                                indicator_printer_state_notifier_get_store (self));
+            break;
+
+        case PROP_ALERT_COOLDOWN:
+            g_value_set_uint (value, self->priv->alert_cooldown);
+            break;
+
+        case PROP_ALERT_BURST:
+            g_value_set_uint (value, self->priv->alert_burst);
+            break;
+
+        case PROP_ALERT_BACKEND:
+            g_value_set_string (value, self->priv->use_notifications ? "notification" : "dialog");
+            break;
+
+        case PROP_NOTIFICATION_INTERVAL:
+            g_value_set_uint (value, self->priv->notification_interval);
+            break;
+
+        case PROP_MODULE_DIR:
+            g_value_set_string (value, self->priv->module_dir);
             break;
 
         default:
@@ -218,9 +724,31 @@ set_property (GObject      *object,
 
     switch (property_id)
     {
-        case PROP_CUPS_NOTIFIER:
-            indicator_printer_state_notifier_set_cups_notifier (self,
-                                                                g_value_get_object (value));
+        case PROP_STORE:
+            indicator_printer_state_notifier_set_store (self,
+                                                        g_value_get_object (value));
+            break;
+
+        case PROP_ALERT_COOLDOWN:
+            self->priv->alert_cooldown = g_value_get_uint (value);
+            break;
+
+        case PROP_ALERT_BURST:
+            self->priv->alert_burst = g_value_get_uint (value);
+            break;
+
+        case PROP_ALERT_BACKEND:
+            self->priv->use_notifications = g_strcmp0 (g_value_get_string (value),
+                                                       "notification") == 0;
+            break;
+
+        case PROP_NOTIFICATION_INTERVAL:
+            self->priv->notification_interval = g_value_get_uint (value);
+            break;
+
+        case PROP_MODULE_DIR:
+            g_free (self->priv->module_dir);
+            self->priv->module_dir = g_value_dup_string (value);
             break;
 
         default:
@@ -234,15 +762,31 @@ dispose (GObject *object)
 {
     IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (object);
 
+    indicator_printer_state_notifier_set_store (self, NULL);
+
+    if (self->priv->notification_flush_id) {
+        g_source_remove (self->priv->notification_flush_id);
+        self->priv->notification_flush_id = 0;
+    }
+    if (self->priv->session_bus) {
+        g_dbus_connection_signal_unsubscribe (self->priv->session_bus,
+                                              self->priv->notification_closed_id);
+        g_dbus_connection_signal_unsubscribe (self->priv->session_bus,
+                                              self->priv->action_invoked_id);
+        g_clear_object (&self->priv->session_bus);
+    }
     if (self->priv->notified_printer_states) {
-        g_hash_table_unref (self->priv->notified_printer_states);
+        notified_state_close (self->priv->notified_printer_states);
         self->priv->notified_printer_states = NULL;
     }
-    if (self->priv->printer_alerts) {
-        g_hash_table_unref (self->priv->printer_alerts);
-        self->priv->printer_alerts = NULL;
+    if (self->priv->alerts) {
+        g_hash_table_unref (self->priv->alerts);
+        self->priv->alerts = NULL;
+    }
+    if (self->priv->awaiting_jobs) {
+        g_hash_table_unref (self->priv->awaiting_jobs);
+        self->priv->awaiting_jobs = NULL;
     }
-    g_clear_object (&self->priv->cups_notifier);
 
     G_OBJECT_CLASS (indicator_printer_state_notifier_parent_class)->dispose (object);
 }
@@ -251,6 +795,10 @@ dispose (GObject *object)
 static void
 finalize (GObject *object)
 {
+    IndicatorPrinterStateNotifier *self = INDICATOR_PRINTER_STATE_NOTIFIER (object);
+
+    g_free (self->priv->module_dir);
+
     G_OBJECT_CLASS (indicator_printer_state_notifier_parent_class)->finalize (object);
 }
 
@@ -267,11 +815,46 @@ indicator_printer_state_notifier_class_init (IndicatorPrinterStateNotifierClass
     object_class->dispose = dispose;
     object_class->finalize = finalize;
 
-    properties[PROP_CUPS_NOTIFIER] = g_param_spec_object ("cups-notifier",
-                                                          "Cups Notifier",
-                                                          "A cups notifier object",
-                                                          CUPS_TYPE_NOTIFIER,
-                                                          G_PARAM_READWRITE);
+    properties[PROP_STORE] = g_param_spec_object ("store",
+                                                  "Store",
+                                                  "The printer and job state store",
+                                                  INDICATOR_TYPE_PRINTERS_STORE,
+                                                  G_PARAM_READWRITE);
+
+    properties[PROP_ALERT_COOLDOWN] = g_param_spec_uint ("alert-cooldown",
+                                                         "Alert Cooldown",
+                                                         "Seconds after which another alert "
+                                                         "for the same printer and reason is allowed",
+                                                         0, G_MAXUINT, 600,
+                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+    properties[PROP_ALERT_BURST] = g_param_spec_uint ("alert-burst",
+                                                      "Alert Burst",
+                                                      "Number of alerts for the same printer "
+                                                      "and reason allowed at once",
+                                                      1, G_MAXUINT, 1,
+                                                      G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+    properties[PROP_ALERT_BACKEND] = g_param_spec_string ("alert-backend",
+                                                          "Alert Backend",
+                                                          "How alerts are shown: \"dialog\" or "
+                                                          "\"notification\"",
+                                                          "dialog",
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_NOTIFICATION_INTERVAL] = g_param_spec_uint ("notification-interval",
+                                                                "Notification Interval",
+                                                                "Milliseconds to collect alerts "
+                                                                "before sending a notification",
+                                                                0, G_MAXUINT, 1000,
+                                                                G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+    properties[PROP_MODULE_DIR] = g_param_spec_string ("module-dir",
+                                                       "Module Dir",
+                                                       "Directory the alert dialog module "
+                                                       "is loaded from",
+                                                       PKGLIBDIR,
+                                                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
 
     g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
 }
@@ -287,47 +870,62 @@ indicator_printer_state_notifier_init (IndicatorPrinterStateNotifier *self)
                                         IndicatorPrinterStateNotifierPrivate);
     self->priv = priv;
 
-    priv->notified_printer_states = g_hash_table_new_full (g_str_hash,
-                                                           g_str_equal,
-                                                           g_free,
-                                                           (GDestroyNotify)g_strfreev);
-
-    priv->printer_alerts = g_hash_table_new (g_str_hash, g_str_equal);
-    g_hash_table_insert_many ( priv->printer_alerts,
-                               "media-low", _("The printer “%s” is low on paper."),
-                               "media-empty", _("The printer “%s” is out of paper."),
-                               "toner-low", _("The printer “%s” is low on toner."),
-                               "toner-empty", _("The printer “%s” is out of toner."),
-                               "cover-open", _("A cover is open on the printer “%s”."),
-                               "door-open", _("A door is open on the printer “%s”."),
-                               "cups-missing-filter", _("The printer “%s” can’t be used, because required software is missing."),
-                               "offline", _("The printer “%s” is currently off-line."),
-                               NULL);
+    priv->notified_printer_states = notified_state_open (NULL);
+    priv->awaiting_jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->alerts = g_hash_table_new_full (g_str_hash,
+                                          g_str_equal,
+                                          NULL,
+                                          (GDestroyNotify) alert_free);
+
+    priv->printer_alerts[PRINTER_STATE_REASON_MEDIA_LOW] = _("The printer “%s” is low on paper.");
+    priv->printer_alerts[PRINTER_STATE_REASON_MEDIA_EMPTY] = _("The printer “%s” is out of paper.");
+    priv->printer_alerts[PRINTER_STATE_REASON_TONER_LOW] = _("The printer “%s” is low on toner.");
+    priv->printer_alerts[PRINTER_STATE_REASON_TONER_EMPTY] = _("The printer “%s” is out of toner.");
+    priv->printer_alerts[PRINTER_STATE_REASON_COVER_OPEN] = _("A cover is open on the printer “%s”.");
+    priv->printer_alerts[PRINTER_STATE_REASON_DOOR_OPEN] = _("A door is open on the printer “%s”.");
+    priv->printer_alerts[PRINTER_STATE_REASON_CUPS_MISSING_FILTER] = _("The printer “%s” can’t be used, because required software is missing.");
+    priv->printer_alerts[PRINTER_STATE_REASON_OFFLINE] = _("The printer “%s” is currently off-line.");
 }
 
 
-CupsNotifier *
-indicator_printer_state_notifier_get_cups_notifier (IndicatorPrinterStateNotifier *self)
+IndicatorPrintersStore *
+indicator_printer_state_notifier_get_store (IndicatorPrinterStateNotifier *self)
 {
-    return self->priv->cups_notifier;
+    return self->priv->store;
 }
 
 
 void
-indicator_printer_state_notifier_set_cups_notifier (IndicatorPrinterStateNotifier *self,
-                                                    CupsNotifier *cups_notifier)
+indicator_printer_state_notifier_set_store (IndicatorPrinterStateNotifier *self,
+                                            IndicatorPrintersStore *store)
 {
-    if (self->priv->cups_notifier) {
-        g_signal_handlers_disconnect_by_func (self->priv->cups_notifier,
-                                              on_printer_state_changed,
+    if (self->priv->store) {
+        g_signal_handlers_disconnect_by_func (self->priv->store,
+                                              on_printer_changed,
                                               self);
-        g_clear_object (&self->priv->cups_notifier);
+        g_signal_handlers_disconnect_by_func (self->priv->store,
+                                              on_printer_removed,
+                                              self);
+        g_clear_object (&self->priv->store);
     }
 
-    if (cups_notifier) {
-        self->priv->cups_notifier = g_object_ref (cups_notifier);
-        g_signal_connect (cups_notifier, "printer-state-changed",
-                          G_CALLBACK (on_printer_state_changed), self);
+    if (store) {
+        self->priv->store = g_object_ref (store);
+        g_signal_connect (store, "printer-changed",
+                          G_CALLBACK (on_printer_changed), self);
+        g_signal_connect (store, "printer-removed",
+                          G_CALLBACK (on_printer_removed), self);
     }
 }
 
+
+void
+indicator_printer_state_notifier_get_alert_stats (IndicatorPrinterStateNotifier *self,
+                                                  guint *shown,
+                                                  guint *suppressed)
+{
+    if (shown)
+        *shown = self->priv->alerts_shown;
+    if (suppressed)
+        *suppressed = self->priv->alerts_suppressed;
+}
@@ -20,7 +20,7 @@
 #define INDICATOR_PRINTER_STATE_NOTIFIER_H
 
 #include <glib-object.h>
-#include "cups-notifier.h"
+#include "indicator-printers-store.h"
 
 G_BEGIN_DECLS
 
@@ -64,9 +64,12 @@ struct _IndicatorPrinterStateNotifierClass
 
 GType indicator_printer_state_notifier_get_type (void) G_GNUC_CONST;
 
-CupsNotifier * indicator_printer_state_notifier_get_cups_notifier (IndicatorPrinterStateNotifier *self);
-void indicator_printer_state_notifier_set_cups_notifier (IndicatorPrinterStateNotifier *self,
-                                                         CupsNotifier *cups_notifier);
+IndicatorPrintersStore * indicator_printer_state_notifier_get_store (IndicatorPrinterStateNotifier *self);
+void indicator_printer_state_notifier_set_store (IndicatorPrinterStateNotifier *self,
+                                                 IndicatorPrintersStore *store);
+void indicator_printer_state_notifier_get_alert_stats (IndicatorPrinterStateNotifier *self,
+                                                       guint *shown,
+                                                       guint *suppressed);
 
 
 G_END_DECLS
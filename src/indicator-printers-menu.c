@@ -18,6 +18,7 @@
 
 #include "indicator-printers-menu.h"
 
+#include <string.h>
 #include <glib/gi18n.h>
 
 #include <cups/cups.h>
@@ -28,35 +29,100 @@
 G_DEFINE_TYPE (IndicatorPrintersMenu, indicator_printers_menu, G_TYPE_OBJECT)
 
 
+typedef enum
+{
+    GROUP_BY_NONE,
+    GROUP_BY_LOCATION,
+    GROUP_BY_CLASS
+} GroupBy;
+
+
+/* a printer's menu item or the header of a group of printers, together with
+ * the values last published for it */
+typedef struct
+{
+    DbusmenuMenuitem *item;
+    gchar *name;            /* NULL for group headers */
+    gchar *group;
+    gchar *name_key;        /* collation keys of name and group */
+    gchar *group_key;
+    gboolean wanted;        /* the printer has jobs */
+    gboolean visible;
+    gchar *right;
+    gboolean right_is_lozenge;
+    guint nentries;         /* headers: printers in the group */
+    guint nshown;           /* headers: visible printers in the group */
+} PrinterItem;
+
+
 struct _IndicatorPrintersMenuPrivate
 {
     DbusmenuMenuitem *root;
-    GHashTable *printers;    /* printer name -> dbusmenuitem */
-    CupsNotifier *cups_notifier;
+    gboolean root_visible;
+    GHashTable *printers;    /* printer name -> PrinterItem */
+    GHashTable *headers;     /* group name -> PrinterItem */
+    GPtrArray *entries;      /* printers and headers in the order of the menu */
+    guint nvisible;          /* number of visible printer items */
+    IndicatorPrintersStore *store;
+
+    /* printers are sorted by group and name.  At most max_printers of
+     * them are shown (0 for no limit), the rest are behind "More…" */
+    GroupBy group_by;
+    guint max_printers;
+    DbusmenuMenuitem *more;
+    gboolean more_visible;
+    PrinterItem *last_shown;    /* the last visible printer in menu order */
+    guint nleft_out;            /* printers with jobs that aren't shown */
+
+    /* property writes that were sent to dbusmenu and those that were
+     * skipped because the value didn't change */
+    guint writes_sent;
+    guint writes_suppressed;
 };
 
 
 enum {
     PROP_0,
-    PROP_CUPS_NOTIFIER,
+    PROP_STORE,
+    PROP_GROUP_BY,
+    PROP_MAX_PRINTERS,
     NUM_PROPERTIES
 };
 
 GParamSpec *properties[NUM_PROPERTIES];
 
 
+static gboolean on_root_about_to_show (DbusmenuMenuitem *root,
+                                       gpointer user_data);
+
+
 static void
 dispose (GObject *object)
 {
     IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (object);
 
+    indicator_printers_menu_set_store (self, NULL);
+
+    if (self->priv->entries) {
+        g_ptr_array_unref (self->priv->entries);
+        self->priv->entries = NULL;
+    }
     if (self->priv->printers) {
         g_hash_table_unref (self->priv->printers);
         self->priv->printers = NULL;
     }
+    if (self->priv->headers) {
+        g_hash_table_unref (self->priv->headers);
+        self->priv->headers = NULL;
+    }
+    g_clear_object (&self->priv->more);
 
-    g_clear_object (&self->priv->root);
-    g_clear_object (&self->priv->cups_notifier);
+    if (self->priv->root) {
+        g_signal_handlers_disconnect_by_func (self->priv->root,
+                                              on_root_about_to_show,
+                                              self);
+        g_clear_object (&self->priv->root);
+    }
 
     G_OBJECT_CLASS (indicator_printers_menu_parent_class)->dispose (object);
 }
@@ -71,9 +137,24 @@ set_property (GObject        *object,
     IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (object);
 
     switch (property_id) {
-        case PROP_CUPS_NOTIFIER:
-            indicator_printers_menu_set_cups_notifier (self,
-                                                       g_value_get_object (value));
+        case PROP_STORE:
+            indicator_printers_menu_set_store (self, g_value_get_object (value));
+            break;
+
+        case PROP_GROUP_BY: {
+            const gchar *group_by = g_value_get_string (value);
+
+            if (g_strcmp0 (group_by, "location") == 0)
+                self->priv->group_by = GROUP_BY_LOCATION;
+            else if (g_strcmp0 (group_by, "class") == 0)
+                self->priv->group_by = GROUP_BY_CLASS;
+            else
+                self->priv->group_by = GROUP_BY_NONE;
+            break;
+        }
+
+        case PROP_MAX_PRINTERS:
+            self->priv->max_printers = g_value_get_uint (value);
             break;
 
         default:
@@ -91,9 +172,18 @@ get_property (GObject        *object,
     IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (object);
 
     switch (property_id) {
-        case PROP_CUPS_NOTIFIER:
-            g_value_set_object (value,
-                                indicator_printers_menu_get_cups_notifier (self));
+        case PROP_STORE:
+            g_value_set_object (value, indicator_printers_menu_get_store (self));
+            break;
+
+        case PROP_GROUP_BY: {
+            static const gchar *names[] = { "none", "location", "class" };
+            g_value_set_string (value, names[self->priv->group_by]);
+            break;
+        }
+
+        case PROP_MAX_PRINTERS:
+            g_value_set_uint (value, self->priv->max_printers);
             break;
 
         default:
@@ -113,11 +203,25 @@ indicator_printers_menu_class_init (IndicatorPrintersMenuClass *klass)
     object_class->get_property = get_property;
     object_class->set_property = set_property;
 
-    properties[PROP_CUPS_NOTIFIER] = g_param_spec_object ("cups-notifier",
-                                                          "Cups Notifier",
-                                                          "A cups notifier object",
-                                                          CUPS_TYPE_NOTIFIER,
-                                                          G_PARAM_READWRITE);
+    properties[PROP_STORE] = g_param_spec_object ("store",
+                                                  "Store",
+                                                  "The printer and job state store",
+                                                  INDICATOR_TYPE_PRINTERS_STORE,
+                                                  G_PARAM_READWRITE);
+
+    properties[PROP_GROUP_BY] = g_param_spec_string ("group-by",
+                                                     "Group By",
+                                                     "How printers are grouped: \"none\", "
+                                                     "\"location\" or \"class\"",
+                                                     "none",
+                                                     G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_MAX_PRINTERS] = g_param_spec_uint ("max-printers",
+                                                       "Max Printers",
+                                                       "Maximum number of printers in the menu, "
+                                                       "0 for no limit",
+                                                       0, G_MAXUINT, 0,
+                                                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
 
     g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
 }
@@ -134,45 +238,399 @@ on_printer_item_activated (DbusmenuMenuitem *menuitem,
 
 
 static void
-update_indicator_visibility (IndicatorPrintersMenu *self)
+on_more_item_activated (DbusmenuMenuitem *menuitem,
+                        guint timestamp,
+                        gpointer user_data)
 {
-    GList *it;
-    gboolean is_visible = FALSE;
+    spawn_printer_settings ();
+}
 
-    for (it = dbusmenu_menuitem_get_children (self->priv->root);
-         it;
-         it = g_list_next (it))
-    {
-        DbusmenuMenuitem *child = it->data;
-        if ((is_visible = dbusmenu_menuitem_property_get_bool (child, "visible")))
-            break;
+
+static void
+printer_item_free (PrinterItem *printer)
+{
+    g_object_unref (printer->item);
+    g_free (printer->name);
+    g_free (printer->group);
+    g_free (printer->name_key);
+    g_free (printer->group_key);
+    g_free (printer->right);
+    g_slice_free (PrinterItem, printer);
+}
+
+
+/* Each write to a menu item property is sent to every client of the menu.
+ * These only write when the value differs from the last one written. */
+static gboolean
+publish_bool (IndicatorPrintersMenu *self,
+              DbusmenuMenuitem *item,
+              const gchar *property,
+              gboolean *published,
+              gboolean value)
+{
+    if (*published == value) {
+        self->priv->writes_suppressed++;
+        return FALSE;
+    }
+
+    *published = value;
+    dbusmenu_menuitem_property_set_bool (item, property, value);
+    self->priv->writes_sent++;
+    return TRUE;
+}
+
+
+static void
+publish_string (IndicatorPrintersMenu *self,
+                DbusmenuMenuitem *item,
+                const gchar *property,
+                gchar **published,
+                const gchar *value)
+{
+    if (g_strcmp0 (*published, value) == 0) {
+        self->priv->writes_suppressed++;
+        return;
+    }
+
+    g_free (*published);
+    *published = g_strdup (value);
+    dbusmenu_menuitem_property_set (item, property, value);
+    self->priv->writes_sent++;
+}
+
+
+/* shows or hides a printer's menu item and the indicator along with it, which
+ * is visible as long as any printer is */
+static void
+set_printer_item_visible (IndicatorPrintersMenu *self,
+                          PrinterItem *printer,
+                          gboolean visible)
+{
+    if (!publish_bool (self, printer->item, "visible", &printer->visible, visible))
+        return;
+
+    if (visible)
+        self->priv->nvisible++;
+    else
+        self->priv->nvisible--;
+
+    /* the store tells directly whether there are jobs in lazy mode */
+    if (indicator_printers_store_get_lazy (self->priv->store))
+        return;
+
+    publish_bool (self, self->priv->root, "visible",
+                  &self->priv->root_visible, self->priv->nvisible > 0);
+}
+
+
+static gint
+compare_entries (const PrinterItem *a,
+                 const PrinterItem *b)
+{
+    gint cmp;
+
+    cmp = strcmp (a->group_key, b->group_key);
+    if (cmp != 0)
+        return cmp;
+
+    /* a group's header comes before its printers */
+    if (!a->name || !b->name)
+        return (a->name != NULL) - (b->name != NULL);
+
+    cmp = strcmp (a->name_key, b->name_key);
+    if (cmp != 0)
+        return cmp;
+
+    /* names which collate the same still get a stable order */
+    return strcmp (a->name, b->name);
+}
+
+
+/* Returns the index of the first entry sorting after entry */
+static guint
+find_position (IndicatorPrintersMenu *self,
+               const PrinterItem *entry)
+{
+    GPtrArray *entries = self->priv->entries;
+    guint lo = 0, hi = entries->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (compare_entries (g_ptr_array_index (entries, mid), entry) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/* The root's children are the entries in order, followed by "More…" */
+static void
+insert_entry (IndicatorPrintersMenu *self,
+              PrinterItem *entry)
+{
+    guint pos = find_position (self, entry);
+
+    g_ptr_array_insert (self->priv->entries, pos, entry);
+    dbusmenu_menuitem_child_add_position (self->priv->root, entry->item, pos);
+}
+
+
+static void
+remove_entry (IndicatorPrintersMenu *self,
+              PrinterItem *entry)
+{
+    guint pos = find_position (self, entry);
+
+    g_return_if_fail (pos > 0 && g_ptr_array_index (self->priv->entries, pos - 1) == entry);
+
+    g_ptr_array_remove_index (self->priv->entries, pos - 1);
+    dbusmenu_menuitem_child_delete (self->priv->root, entry->item);
+}
+
+
+static const gchar *
+printer_group (IndicatorPrintersMenu *self,
+               const gchar *printer)
+{
+    const gchar *location;
+
+    switch (self->priv->group_by) {
+        case GROUP_BY_LOCATION:
+            location = indicator_printers_store_get_printer_location (self->priv->store,
+                                                                     printer);
+            return location ? location : _("Other");
+
+        case GROUP_BY_CLASS:
+            if (indicator_printers_store_get_printer_is_class (self->priv->store, printer))
+                return _("Classes");
+            return _("Printers");
+
+        default:
+            return "";
+    }
+}
+
+
+static PrinterItem *
+ensure_group_header (IndicatorPrintersMenu *self,
+                     const gchar *group)
+{
+    PrinterItem *header;
+
+    header = g_hash_table_lookup (self->priv->headers, group);
+    if (header)
+        return header;
+
+    header = g_slice_new0 (PrinterItem);
+    header->item = dbusmenu_menuitem_new ();
+    dbusmenu_menuitem_property_set_bool (header->item, "visible", FALSE);
+    dbusmenu_menuitem_property_set_bool (header->item, "enabled", FALSE);
+    dbusmenu_menuitem_property_set (header->item, "label", group);
+    header->group = g_strdup (group);
+    header->group_key = g_utf8_collate_key (group, -1);
+
+    g_hash_table_insert (self->priv->headers, header->group, header);
+    insert_entry (self, header);
+
+    return header;
+}
+
+
+/* Adds a printer at its sorted position, below the header of its group */
+static void
+link_entry (IndicatorPrintersMenu *self,
+            PrinterItem *entry)
+{
+    if (self->priv->group_by != GROUP_BY_NONE)
+        ensure_group_header (self, entry->group)->nentries++;
+
+    insert_entry (self, entry);
+}
+
+
+/* Removes a hidden printer from the menu, and the header of its group when
+ * it was the group's last printer */
+static void
+unlink_entry (IndicatorPrintersMenu *self,
+              PrinterItem *entry)
+{
+    PrinterItem *header;
+
+    remove_entry (self, entry);
+
+    header = g_hash_table_lookup (self->priv->headers, entry->group);
+    if (header && --header->nentries == 0) {
+        remove_entry (self, header);
+        g_hash_table_remove (self->priv->headers, entry->group);
+    }
+}
+
+
+/* Shows or hides a printer, and the header of its group along with it */
+static void
+set_entry_shown (IndicatorPrintersMenu *self,
+                 PrinterItem *entry,
+                 gboolean shown)
+{
+    PrinterItem *header;
+
+    if (entry->visible == shown)
+        return;
+
+    set_printer_item_visible (self, entry, shown);
+
+    header = g_hash_table_lookup (self->priv->headers, entry->group);
+    if (header) {
+        if (shown)
+            header->nshown++;
+        else
+            header->nshown--;
+        publish_bool (self, header->item, "visible", &header->visible, header->nshown > 0);
+    }
+}
+
+
+/* Returns the closest visible printer before position pos, or NULL */
+static PrinterItem *
+find_shown_before (IndicatorPrintersMenu *self,
+                   guint pos)
+{
+    while (pos-- > 0) {
+        PrinterItem *entry = g_ptr_array_index (self->priv->entries, pos);
+
+        if (entry->name && entry->visible)
+            return entry;
     }
 
-    dbusmenu_menuitem_property_set_bool (self->priv->root, "visible", is_visible);
+    return NULL;
+}
+
+
+/* Returns the first printer with jobs which is left out after position pos */
+static PrinterItem *
+find_left_out_after (IndicatorPrintersMenu *self,
+                     guint pos)
+{
+    for (; pos < self->priv->entries->len; pos++) {
+        PrinterItem *entry = g_ptr_array_index (self->priv->entries, pos);
+
+        if (entry->name && entry->wanted && !entry->visible)
+            return entry;
+    }
+
+    return NULL;
+}
+
+
+/* The menu shows the first max_printers printers with jobs in menu order,
+ * the headers of the groups they are in, and "More…" when printers were left
+ * out.  These keep it that way when a printer starts or stops being shown,
+ * touching only the printers around the last shown one instead of walking
+ * the whole menu. */
+
+/* Called when entry, which is in the menu, got jobs */
+static void
+place_entry (IndicatorPrintersMenu *self,
+             PrinterItem *entry)
+{
+    PrinterItem *last = self->priv->last_shown;
+
+    if (self->priv->max_printers == 0) {
+        set_entry_shown (self, entry, TRUE);
+        return;
+    }
+
+    if (self->priv->nvisible < self->priv->max_printers) {
+        set_entry_shown (self, entry, TRUE);
+        if (!last || compare_entries (entry, last) > 0)
+            self->priv->last_shown = entry;
+    }
+    else if (compare_entries (entry, last) < 0) {
+        /* entry takes the place of the last shown printer */
+        set_entry_shown (self, entry, TRUE);
+        set_entry_shown (self, last, FALSE);
+        self->priv->last_shown = find_shown_before (self, find_position (self, last) - 1);
+        self->priv->nleft_out++;
+    }
+    else {
+        self->priv->nleft_out++;
+    }
+
+    publish_bool (self, self->priv->more, "visible", &self->priv->more_visible,
+                  self->priv->nleft_out > 0);
+}
+
+
+/* Called when entry, which is still in the menu at its old position, is
+ * about to lose its jobs or be moved or removed */
+static void
+withdraw_entry (IndicatorPrintersMenu *self,
+                PrinterItem *entry)
+{
+    PrinterItem *next;
+    guint pos;
+
+    if (self->priv->max_printers == 0) {
+        set_entry_shown (self, entry, FALSE);
+        return;
+    }
+
+    if (!entry->visible) {
+        self->priv->nleft_out--;
+    }
+    else {
+        set_entry_shown (self, entry, FALSE);
+
+        /* the first printer that was left out moves up */
+        pos = find_position (self, self->priv->last_shown);
+        next = self->priv->nleft_out > 0 ? find_left_out_after (self, pos) : NULL;
+        if (next) {
+            set_entry_shown (self, next, TRUE);
+            self->priv->last_shown = next;
+            self->priv->nleft_out--;
+        }
+        else if (entry == self->priv->last_shown) {
+            self->priv->last_shown = find_shown_before (self, pos - 1);
+        }
+    }
+
+    publish_bool (self, self->priv->more, "visible", &self->priv->more_visible,
+                  self->priv->nleft_out > 0);
 }
 
 
 static void
 update_printer_menuitem (IndicatorPrintersMenu *self,
-                         const char *printer,
-                         int state)
+                         const char *printer)
 {
+    PrinterItem *printer_item;
     DbusmenuMenuitem *item;
-    int njobs;
-    cups_job_t *jobs;
+    const gchar *group;
+    gboolean moved, wanted;
+    int njobs, state;
 
-    njobs = cupsGetJobs (&jobs, printer, 1, CUPS_WHICHJOBS_ACTIVE);
-    cupsFreeJobs (njobs, jobs);
+    njobs = indicator_printers_store_get_njobs (self->priv->store, printer);
+    state = indicator_printers_store_get_printer_state (self->priv->store, printer);
 
     if (njobs < 0) {
         g_warning ("printer '%s' does not exist\n", printer);
         return;
     }
 
-    item = g_hash_table_lookup (self->priv->printers, printer);
+    printer_item = g_hash_table_lookup (self->priv->printers, printer);
+
+    if (!printer_item) {
+        /* items are only created for printers which have had jobs, to keep
+         * the menu small on sites with many printers */
+        if (njobs == 0)
+            return;
 
-    if (!item) {
         item = dbusmenu_menuitem_new ();
+        dbusmenu_menuitem_property_set_bool (item, "visible", FALSE);
         dbusmenu_menuitem_property_set (item, "type", "indicator-item");
         dbusmenu_menuitem_property_set (item, "indicator-icon-name", "printer");
         dbusmenu_menuitem_property_set (item, "indicator-label", printer);
@@ -180,32 +638,56 @@ update_printer_menuitem (IndicatorPrintersMenu *self,
                                G_CALLBACK (on_printer_item_activated),
                                g_strdup (printer), (GClosureNotify) g_free, 0);
 
-        dbusmenu_menuitem_child_append(self->priv->root, item);
-        g_hash_table_insert (self->priv->printers, g_strdup (printer), item);
+        printer_item = g_slice_new0 (PrinterItem);
+        printer_item->item = item;
+        printer_item->name = g_strdup (printer);
+        printer_item->name_key = g_utf8_collate_key (printer, -1);
+        g_hash_table_insert (self->priv->printers, printer_item->name, printer_item);
     }
 
-    if (njobs == 0) {
-        dbusmenu_menuitem_property_set_bool (item, "visible", FALSE);
-        update_indicator_visibility (self);
-        return;
+    /* new printers and printers that moved to another group are (re)inserted
+     * at their sorted position */
+    group = printer_group (self, printer);
+    moved = g_strcmp0 (printer_item->group, group) != 0;
+    wanted = njobs > 0;
+
+    if (printer_item->wanted && (moved || !wanted))
+        withdraw_entry (self, printer_item);
+
+    if (moved) {
+        if (printer_item->group)
+            unlink_entry (self, printer_item);
+
+        g_free (printer_item->group);
+        g_free (printer_item->group_key);
+        printer_item->group = g_strdup (group);
+        printer_item->group_key = g_utf8_collate_key (group, -1);
+
+        link_entry (self, printer_item);
     }
 
-    /* there are jobs for this printer. Make sure the indicator and the menu
-     * item for that printer are shown */
-    dbusmenu_menuitem_property_set_bool (self->priv->root, "visible", TRUE);
-    dbusmenu_menuitem_property_set_bool (item, "visible", TRUE);
+    if (wanted && (moved || !printer_item->wanted))
+        place_entry (self, printer_item);
+    printer_item->wanted = wanted;
+
+    if (njobs == 0)
+        return;
 
     switch (state) {
         case IPP_PRINTER_STOPPED:
-            dbusmenu_menuitem_property_set (item, "indicator-right", _("Paused"));
-            dbusmenu_menuitem_property_set_bool (item, "indicator-right-is-lozenge", FALSE);
+            publish_string (self, printer_item->item, "indicator-right",
+                            &printer_item->right, _("Paused"));
+            publish_bool (self, printer_item->item, "indicator-right-is-lozenge",
+                          &printer_item->right_is_lozenge, FALSE);
             break;
 
         case IPP_PRINTER_PROCESSING: {
-            gchar *jobstr = g_strdup_printf ("%d", njobs);
-            dbusmenu_menuitem_property_set (item, "indicator-right", jobstr);
-            dbusmenu_menuitem_property_set_bool (item, "indicator-right-is-lozenge", TRUE);
-            g_free (jobstr);
+            gchar jobstr[16];
+            g_snprintf (jobstr, sizeof jobstr, "%d", njobs);
+            publish_string (self, printer_item->item, "indicator-right",
+                            &printer_item->right, jobstr);
+            publish_bool (self, printer_item->item, "indicator-right-is-lozenge",
+                          &printer_item->right_is_lozenge, TRUE);
             break;
         }
     }
@@ -215,61 +697,73 @@ update_printer_menuitem (IndicatorPrintersMenu *self,
 static void
 update_all_printer_menuitems (IndicatorPrintersMenu *self)
 {
-    int ndests, i;
-    cups_dest_t *dests;
+    GList *printers, *it;
 
-    ndests = cupsGetDests (&dests);
-    for (i = 0; i < ndests; i++) {
-        int state = atoi (cupsGetOption ("printer-state",
-                                         dests[i].num_options,
-                                         dests[i].options));
-        update_printer_menuitem (self, dests[i].name, state);
-    }
-    cupsFreeDests (ndests, dests);
+    printers = indicator_printers_store_get_printers (self->priv->store);
+    for (it = printers; it; it = g_list_next (it))
+        update_printer_menuitem (self, it->data);
+    g_list_free (printers);
 }
 
 
 static void
-update_job (CupsNotifier *cups_notifier,
-            const gchar *text,
-            const gchar *printer_uri,
-            const gchar *printer_name,
-            guint printer_state,
-            const gchar *printer_state_reasons,
-            gboolean printer_is_accepting_jobs,
-            guint job_id,
-            guint job_state,
-            const gchar *job_state_reasons,
-            const gchar *job_name,
-            guint job_impressions_completed,
-            gpointer user_data)
+on_printer_changed (IndicatorPrintersStore *store,
+                    const gchar *printer,
+                    gpointer user_data)
 {
     IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (user_data);
 
-    /* CUPS doesn't send the printer's name for these events.  Update all menu
-     * items as a temporary workaround */
-    if (job_state == IPP_JOB_CANCELLED ||
-        job_state == IPP_JOB_ABORTED ||
-        job_state == IPP_JOB_COMPLETED)
-        update_all_printer_menuitems (self);
-    else
-        update_printer_menuitem (self, printer_name, printer_state);
+    update_printer_menuitem (self, printer);
 }
 
 
 static void
-on_printer_state_changed (CupsNotifier *object,
-                          const gchar *text,
-                          const gchar *printer_uri,
-                          const gchar *printer_name,
-                          guint printer_state,
-                          const gchar *printer_state_reasons,
-                          gboolean printer_is_accepting_jobs,
-                          gpointer user_data)
+on_printer_removed (IndicatorPrintersStore *store,
+                    const gchar *printer,
+                    gpointer user_data)
 {
     IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (user_data);
+    PrinterItem *printer_item;
+
+    printer_item = g_hash_table_lookup (self->priv->printers, printer);
+    if (!printer_item)
+        return;
+
+    /* a printer that was left out might take its place */
+    if (printer_item->wanted)
+        withdraw_entry (self, printer_item);
+    unlink_entry (self, printer_item);
 
-    update_printer_menuitem (self, printer_name, printer_state);
+    /* drops the last reference to the item, which frees the printer name
+     * passed to on_printer_item_activated */
+    g_hash_table_remove (self->priv->printers, printer);
+}
+
+
+static void
+on_has_jobs_changed (GObject *object,
+                     GParamSpec *pspec,
+                     gpointer user_data)
+{
+    IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (user_data);
+
+    publish_bool (self, self->priv->root, "visible", &self->priv->root_visible,
+                  indicator_printers_store_get_has_jobs (self->priv->store));
+}
+
+
+/* a lazy store only loads the printers and their jobs when the menu is
+ * about to be opened */
+static gboolean
+on_root_about_to_show (DbusmenuMenuitem *root,
+                       gpointer user_data)
+{
+    IndicatorPrintersMenu *self = INDICATOR_PRINTERS_MENU (user_data);
+
+    if (self->priv->store)
+        indicator_printers_store_populate (self->priv->store);
+
+    return FALSE;
 }
 
 
@@ -282,14 +776,25 @@ indicator_printers_menu_init (IndicatorPrintersMenu *self)
 
     self->priv->root = dbusmenu_menuitem_new ();
     dbusmenu_menuitem_property_set_bool (self->priv->root, "visible", FALSE);
+    g_signal_connect (self->priv->root, DBUSMENU_MENUITEM_SIGNAL_ABOUT_TO_SHOW,
+                      G_CALLBACK (on_root_about_to_show), self);
+
+    self->priv->more = dbusmenu_menuitem_new ();
+    dbusmenu_menuitem_property_set_bool (self->priv->more, "visible", FALSE);
+    dbusmenu_menuitem_property_set (self->priv->more, "label", _("More…"));
+    g_signal_connect (self->priv->more, "item-activated",
+                      G_CALLBACK (on_more_item_activated), NULL);
+    dbusmenu_menuitem_child_append (self->priv->root, self->priv->more);
 
     self->priv->printers = g_hash_table_new_full (g_str_hash,
                                                   g_str_equal,
-                                                  g_free,
-                                                  g_object_unref);
-
-    /* create initial menu items */
-    update_all_printer_menuitems (self);
+                                                  NULL,
+                                                  (GDestroyNotify) printer_item_free);
+    self->priv->headers = g_hash_table_new_full (g_str_hash,
+                                                 g_str_equal,
+                                                 NULL,
+                                                 (GDestroyNotify) printer_item_free);
+    self->priv->entries = g_ptr_array_new ();
 }
 
 
@@ -307,33 +812,56 @@ indicator_printers_menu_get_root (IndicatorPrintersMenu *self)
 }
 
 
-CupsNotifier *
-indicator_printers_menu_get_cups_notifier (IndicatorPrintersMenu *self)
+void
+indicator_printers_menu_get_write_stats (IndicatorPrintersMenu *self,
+                                         guint *sent,
+                                         guint *suppressed)
+{
+    if (sent)
+        *sent = self->priv->writes_sent;
+    if (suppressed)
+        *suppressed = self->priv->writes_suppressed;
+}
+
+
+IndicatorPrintersStore *
+indicator_printers_menu_get_store (IndicatorPrintersMenu *self)
 {
-    return self->priv->cups_notifier;
+    return self->priv->store;
 }
 
 
 void
-indicator_printers_menu_set_cups_notifier (IndicatorPrintersMenu *self,
-                                           CupsNotifier *cups_notifier)
-{
-    if (self->priv->cups_notifier) {
-        g_object_disconnect (self->priv->cups_notifier,
-                             "any-signal", update_job, self,
-                             "any-signal", on_printer_state_changed, self,
-                             NULL);
-        g_clear_object (&self->priv->cups_notifier);
+indicator_printers_menu_set_store (IndicatorPrintersMenu *self,
+                                   IndicatorPrintersStore *store)
+{
+    if (self->priv->store) {
+        g_signal_handlers_disconnect_by_func (self->priv->store,
+                                              on_printer_changed,
+                                              self);
+        g_signal_handlers_disconnect_by_func (self->priv->store,
+                                              on_printer_removed,
+                                              self);
+        g_signal_handlers_disconnect_by_func (self->priv->store,
+                                              on_has_jobs_changed,
+                                              self);
+        g_clear_object (&self->priv->store);
     }
 
-    if (cups_notifier) {
-        self->priv->cups_notifier = g_object_ref (cups_notifier);
-        g_object_connect (self->priv->cups_notifier,
-                          "signal::job-created", update_job, self,
-                          "signal::job-state", update_job, self,
-                          "signal::job-completed", update_job, self,
-                          "signal::printer-state-changed", on_printer_state_changed, self,
-                          NULL);
+    if (store) {
+        self->priv->store = g_object_ref (store);
+        g_signal_connect (store, "printer-changed",
+                          G_CALLBACK (on_printer_changed), self);
+        g_signal_connect (store, "printer-removed",
+                          G_CALLBACK (on_printer_removed), self);
+
+        if (indicator_printers_store_get_lazy (store)) {
+            g_signal_connect (store, "notify::has-jobs",
+                              G_CALLBACK (on_has_jobs_changed), self);
+            on_has_jobs_changed (G_OBJECT (store), NULL, self);
+        }
+
+        /* create initial menu items */
+        update_all_printer_menuitems (self);
     }
 }
-
@@ -22,7 +22,7 @@
 #include <glib-object.h>
 #include <libdbusmenu-glib/dbusmenu-glib.h>
 
-#include "cups-notifier.h"
+#include "indicator-printers-store.h"
 
 G_BEGIN_DECLS
 
@@ -67,9 +67,12 @@ GType indicator_printers_menu_get_type (void) G_GNUC_CONST;
 
 IndicatorPrintersMenu *indicator_printers_menu_new (void);
 DbusmenuMenuitem * indicator_printers_menu_get_root (IndicatorPrintersMenu *menu);
-CupsNotifier * indicator_printers_menu_get_cups_notifier (IndicatorPrintersMenu *self);
-void indicator_printers_menu_set_cups_notifier (IndicatorPrintersMenu *self,
-                                                CupsNotifier *cups_notifier);
+void indicator_printers_menu_get_write_stats (IndicatorPrintersMenu *self,
+                                              guint *sent,
+                                              guint *suppressed);
+IndicatorPrintersStore * indicator_printers_menu_get_store (IndicatorPrintersMenu *self);
+void indicator_printers_menu_set_store (IndicatorPrintersMenu *self,
+                                        IndicatorPrintersStore *store);
 
 G_END_DECLS
 
@@ -16,131 +16,146 @@
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <libindicator/indicator-service.h>
+#include <locale.h>
+#include <signal.h>
+#include <glib/gi18n.h>
+#include <glib-unix.h>
 #include <libdbusmenu-glib/dbusmenu-glib.h>
-#include <gtk/gtk.h>
 #include <cups/cups.h>
 #include "dbus-names.h"
 #include "config.h"
 
 #include "cups-notifier.h"
+#include "indicator-cups-listener.h"
+#include "indicator-cups-subscription.h"
+#include "indicator-ipp-client.h"
+#include "indicator-ippget-notifier.h"
 #include "indicator-printers-menu.h"
+#include "indicator-printers-store.h"
 #include "indicator-printer-state-notifier.h"
+#include "service-config.h"
 
-#define NOTIFY_LEASE_DURATION (24 * 60 * 60)
 
+static GMainLoop *main_loop;
+static IndicatorIppClient *ipp_client;
+static IndicatorPrintersStore *store;
+static IndicatorCupsSubscription *subscription;
+static IndicatorCupsListener *cups_listener;
+static IndicatorIppgetNotifier *ippget_notifier;
 
-static int
-create_subscription ()
+/* Events are fetched from cupsd with Get-Notifications and emitted on a
+ * stand-in for the proxy of cupsd's dbus notifier.  This works without the
+ * system bus, e.g. in containers. */
+static void
+start_ippget_notifier ()
 {
-    ipp_t *req;
-    ipp_t *resp;
-    ipp_attribute_t *attr;
-    int id = 0;
-
-    req = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
-    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
-                  "printer-uri", NULL, "/");
-    ippAddString (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
-                  "notify-events", NULL, "all");
-    ippAddString (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
-                  "notify-recipient-uri", NULL, "dbus://");
-    ippAddInteger (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-                   "notify-lease-duration", NOTIFY_LEASE_DURATION);
-
-    resp = cupsDoRequest (CUPS_HTTP_DEFAULT, req, "/");
-    if (!resp || cupsLastError() != IPP_OK) {
-        g_warning ("Error subscribing to CUPS notifications: %s\n",
-                   cupsLastErrorString ());
-        return 0;
-    }
+    CupsNotifier *cups_notifier;
 
-    attr = ippFindAttribute (resp, "notify-subscription-id", IPP_TAG_INTEGER);
-    if (attr)
-        id = ippGetInteger (attr, 0);
-    else
-        g_warning ("ipp-create-printer-subscription response doesn't contain "
-                   "subscription id.\n");
+    if (ippget_notifier)
+        return;
+
+    ippget_notifier = g_object_new (INDICATOR_TYPE_IPPGET_NOTIFIER,
+                                    "ipp-client", ipp_client,
+                                    "subscription", subscription,
+                                    "min-interval", (guint) MAX (service_config_get_int ("poll-min-interval", 1000), 1),
+                                    "max-interval", (guint) MAX (service_config_get_int ("poll-max-interval", 30000), 1),
+                                    NULL);
+    g_signal_connect_swapped (ippget_notifier, "events-lost",
+                              G_CALLBACK (indicator_printers_store_queue_resync), store);
 
-    ippDelete (resp);
-    return id;
+    indicator_cups_subscription_set_pull (subscription, TRUE);
+
+    cups_notifier = indicator_ippget_notifier_get_cups_notifier (ippget_notifier);
+    indicator_printers_store_set_cups_notifier (store, cups_notifier);
+    indicator_cups_subscription_set_cups_notifier (subscription, cups_notifier);
 }
 
 
-static gboolean
-renew_subscription (int id)
+static void
+on_listener_connection_failed (IndicatorCupsListener *listener,
+                               gpointer user_data)
 {
-    ipp_t *req;
-    ipp_t *resp;
-
-    req = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
-    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                   "notify-subscription-id", id);
-    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
-                  "printer-uri", NULL, "/");
-    ippAddString (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
-                  "notify-recipient-uri", NULL, "dbus://");
-    ippAddInteger (req, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-                   "notify-lease-duration", NOTIFY_LEASE_DURATION);
-
-    resp = cupsDoRequest (CUPS_HTTP_DEFAULT, req, "/");
-    if (!resp || cupsLastError() != IPP_OK) {
-        g_warning ("Error renewing CUPS subscription %d: %s\n",
-                   id, cupsLastErrorString ());
-        return FALSE;
-    }
+    g_warning ("Not receiving signals from cupsd, polling for events instead");
+    start_ippget_notifier ();
+    g_clear_object (&cups_listener);
+}
 
-    ippDelete (resp);
-    return TRUE;
+
+static void
+on_recipient_rejected (IndicatorCupsSubscription *subscription,
+                       gpointer user_data)
+{
+    start_ippget_notifier ();
+    g_clear_object (&cups_listener);
 }
 
 
-static gboolean
-renew_subscription_timeout (gpointer userdata)
+/* cupsd's signals are received on a thread of their own, which only hands
+ * the decoded events to the main thread */
+static void
+start_cups_listener ()
 {
-    int *subscription_id = userdata;
+    CupsNotifier *cups_notifier;
 
-    if (*subscription_id <= 0 || !renew_subscription (*subscription_id))
-        *subscription_id = create_subscription ();
+    cups_listener = indicator_cups_listener_new ();
+    g_signal_connect_swapped (cups_listener, "events-lost",
+                              G_CALLBACK (indicator_printers_store_queue_resync), store);
+    g_signal_connect (cups_listener, "connection-failed",
+                      G_CALLBACK (on_listener_connection_failed), NULL);
 
-    return TRUE;
+    cups_notifier = indicator_cups_listener_get_cups_notifier (cups_listener);
+    indicator_printers_store_set_cups_notifier (store, cups_notifier);
+    indicator_cups_subscription_set_cups_notifier (subscription, cups_notifier);
 }
 
 
-void
-cancel_subscription (int id)
+/* the subscription is only cancelled when the service shuts down */
+static void
+subscription_cancelled (GObject *source_object,
+                        GAsyncResult *result,
+                        gpointer user_data)
 {
-    ipp_t *req;
-    ipp_t *resp;
+    GError *error = NULL;
+
+    if (!indicator_cups_subscription_cancel_finish (subscription, result, &error))
+        g_error_free (error);
+
+    g_main_loop_quit (main_loop);
+}
 
-    if (id <= 0)
-        return;
 
-    req = ippNewRequest (IPP_CANCEL_SUBSCRIPTION);
-    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
-                  "printer-uri", NULL, "/");
-    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                   "notify-subscription-id", id);
+/* Quits the main loop once the subscription is cancelled, so that the
+ * teardown after it (saving the cache among others) runs */
+static void
+shut_down (void)
+{
+    static gboolean shutting_down;
 
-    resp = cupsDoRequest (CUPS_HTTP_DEFAULT, req, "/");
-    if (!resp || cupsLastError() != IPP_OK) {
-        g_warning ("Error subscribing to CUPS notifications: %s\n",
-                   cupsLastErrorString ());
+    if (shutting_down)
         return;
-    }
 
-    ippDelete (resp);
+    shutting_down = TRUE;
+    indicator_cups_subscription_cancel_async (subscription,
+                                              subscription_cancelled,
+                                              NULL);
 }
 
+
 static void
 name_lost (GDBusConnection *connection,
            const gchar     *name,
            gpointer         user_data)
 {
-    int subscription_id = GPOINTER_TO_INT (user_data);
+    shut_down ();
+}
+
 
-    cancel_subscription (subscription_id);
-    gtk_main_quit ();
+/* the session sends SIGTERM on logout */
+static gboolean
+on_terminate (gpointer user_data)
+{
+    shut_down ();
+    return G_SOURCE_CONTINUE;
 }
 
 int main (int argc, char *argv[])
@@ -152,55 +167,146 @@ int main (int argc, char *argv[])
     textdomain (GETTEXT_PACKAGE);
 
     DbusmenuServer *menuserver;
-    CupsNotifier *cups_notifier;
     IndicatorPrintersMenu *menu;
     IndicatorPrinterStateNotifier *state_notifier;
-    GError *error = NULL;
-    int subscription_id;
+    gchar *cache_file;
+    gchar *group_by;
+    gchar *alert_backend;
+    gchar *extra_events;
+    gchar *transport;
+    guint events_received, events_merged;
+    guint writes_sent, writes_suppressed;
+    guint alerts_shown, alerts_suppressed;
+
+    /* GTK is only loaded when the first alert dialog is shown */
+    main_loop = g_main_loop_new (NULL, FALSE);
+
+    g_unix_signal_add (SIGTERM, on_terminate, NULL);
+    g_unix_signal_add (SIGINT, on_terminate, NULL);
 
-    gtk_init (&argc, &argv);
+    service_config_load ();
 
-    subscription_id = create_subscription ();
-    g_timeout_add_seconds (NOTIFY_LEASE_DURATION - 60,
-                           renew_subscription_timeout,
-                           &subscription_id);
+    ipp_client = indicator_ipp_client_new (CLAMP (service_config_get_int ("ipp-connections", 4), 1, 64));
 
+    /* Nothing below waits for cupsd or the buses: the bus name, the
+     * connection for cupsd's signals, the subscription and the initial load of the
+     * store are all in flight at the same time, and the menu is exported
+     * right away.  It fills in once the store has loaded. */
     g_bus_own_name (G_BUS_TYPE_SESSION,
                     INDICATOR_PRINTERS_DBUS_NAME,
                     G_BUS_NAME_OWNER_FLAGS_NONE,
                     NULL, NULL, name_lost,
-                    GINT_TO_POINTER (subscription_id), NULL);
-
-    cups_notifier = cups_notifier_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                                          0,
-                                                          NULL,
-                                                          CUPS_DBUS_PATH,
-                                                          NULL,
-                                                          &error);
-    if (error) {
-        g_warning ("Error creating cups notify handler: %s", error->message);
-        g_error_free (error);
-        return 1;
+                    NULL, NULL);
+
+    cache_file = g_build_filename (g_get_user_cache_dir (),
+                                   "indicator-printers", "printers", NULL);
+    store = g_object_new (INDICATOR_TYPE_PRINTERS_STORE,
+                          "ipp-client", ipp_client,
+                          "cache-file", cache_file,
+                          "cache-interval", (guint) MAX (service_config_get_int ("cache-interval", 300), 0),
+                          "coalesce-window", (guint) MAX (service_config_get_int ("coalesce-window", 100), 0),
+                          "lazy", service_config_get_boolean ("lazy", FALSE),
+                          "populate-ttl", (guint) MAX (service_config_get_int ("populate-ttl", 5000), 0),
+                          NULL);
+    g_free (cache_file);
+
+    subscription = g_object_new (INDICATOR_TYPE_CUPS_SUBSCRIPTION,
+                                 "ipp-client", ipp_client,
+                                 "store", store,
+                                 NULL);
+    g_signal_connect (subscription, "recipient-rejected",
+                      G_CALLBACK (on_recipient_rejected), NULL);
+
+    /* events needed by anything beyond the store, e.g. "printer-finishings-changed" */
+    extra_events = service_config_get_string ("notify-events", NULL);
+    if (extra_events) {
+        gchar **events = g_strsplit_set (extra_events, ", ", -1);
+        gchar **out = events;
+        gchar **in;
+
+        /* drop the empty strings between consecutive separators */
+        for (in = events; *in; in++) {
+            if (**in)
+                *out++ = *in;
+            else
+                g_free (*in);
+        }
+        *out = NULL;
+
+        indicator_cups_subscription_require_events (subscription,
+                                                    (const gchar * const *) events);
+        g_strfreev (events);
+        g_free (extra_events);
     }
 
+    transport = service_config_get_string ("notify-transport", "dbus");
+    if (g_str_equal (transport, "ippget"))
+        start_ippget_notifier ();
+    else
+        start_cups_listener ();
+    g_free (transport);
+
+    indicator_cups_subscription_subscribe (subscription);
+
+    group_by = service_config_get_string ("group-by", "none");
     menu = g_object_new (INDICATOR_TYPE_PRINTERS_MENU,
-                         "cups-notifier", cups_notifier,
+                         "group-by", group_by,
+                         "max-printers", (guint) MAX (service_config_get_int ("max-printers", 0), 0),
+                         "store", store,
                          NULL);
+    g_free (group_by);
 
     menuserver = dbusmenu_server_new (INDICATOR_PRINTERS_DBUS_OBJECT_PATH);
     dbusmenu_server_set_root (menuserver,
                               indicator_printers_menu_get_root (menu));
 
+    alert_backend = service_config_get_string ("alert-backend", "dialog");
     state_notifier = g_object_new (INDICATOR_TYPE_PRINTER_STATE_NOTIFIER,
-                                   "cups-notifier", cups_notifier,
+                                   "store", store,
+                                   "alert-cooldown", (guint) MAX (service_config_get_int ("alert-cooldown", 600), 0),
+                                   "alert-burst", (guint) MAX (service_config_get_int ("alert-burst", 1), 1),
+                                   "alert-backend", alert_backend,
+                                   "notification-interval", (guint) MAX (service_config_get_int ("notification-interval", 1000), 0),
                                    NULL);
+    g_free (alert_backend);
+
+    g_main_loop_run (main_loop);
 
-    gtk_main ();
+    indicator_printers_store_get_event_stats (store, &events_received, &events_merged);
+    g_debug ("%u cups events received, %u merged", events_received, events_merged);
+    g_debug ("%u lost cups signals detected",
+             indicator_printers_store_get_gaps_detected (store));
+    indicator_printers_menu_get_write_stats (menu, &writes_sent, &writes_suppressed);
+    g_debug ("%u menu property writes sent, %u suppressed", writes_sent, writes_suppressed);
+    indicator_printer_state_notifier_get_alert_stats (state_notifier, &alerts_shown, &alerts_suppressed);
+    g_debug ("%u alerts shown, %u suppressed", alerts_shown, alerts_suppressed);
 
     g_object_unref (menu);
     g_object_unref (menuserver);
     g_object_unref (state_notifier);
-    g_object_unref (cups_notifier);
+    if (cups_listener) {
+        guint received, jobs_created, dropped, mismatched;
+
+        indicator_cups_listener_get_stats (cups_listener, &received, &jobs_created,
+                                           &dropped, &mismatched);
+        g_debug ("%u cups signals received for %u jobs (%.1f per job), %u dropped, %u mismatched",
+                 received, jobs_created,
+                 jobs_created ? (gdouble) received / jobs_created : 0.0,
+                 dropped, mismatched);
+        g_object_unref (cups_listener);
+    }
+    if (ippget_notifier) {
+        guint polls, events;
+
+        indicator_ippget_notifier_get_poll_stats (ippget_notifier, &polls, &events);
+        g_debug ("%u polls for %u cups events", polls, events);
+        g_object_unref (ippget_notifier);
+    }
+    g_object_unref (subscription);
+    g_object_unref (store);
+    g_object_unref (ipp_client);
+    service_config_free ();
+    g_main_loop_unref (main_loop);
     return 0;
 }
 
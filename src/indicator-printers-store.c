@@ -0,0 +1,1999 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "indicator-printers-store.h"
+
+#include <string.h>
+#include <cups/cups.h>
+
+#include "indicator-ipp-client.h"
+
+
+G_DEFINE_TYPE (IndicatorPrintersStore, indicator_printers_store, G_TYPE_OBJECT)
+
+
+/* version, then name, state, state reasons, location, whether it is a class
+ * and number of jobs for each printer */
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(ua(sissbi))"
+
+typedef struct
+{
+    gchar *name;
+    gint state;
+    gint njobs;             /* active jobs of the current user */
+    gint nheld;             /* of those, jobs that are held */
+    gint64 jobs_loaded_at;  /* monotonic time njobs was loaded, 0 if unknown */
+    gchar *state_reasons;
+    gchar *location;
+    gboolean is_class;
+} Printer;
+
+
+/* state of a reload from CUPS while its replies are arriving */
+typedef struct
+{
+    IndicatorPrintersStore *store;
+    guint generation;
+    gint pending;               /* number of outstanding replies */
+    gboolean failed;
+    GHashTable *states;         /* printer name -> printer state */
+    GHashTable *reasons;        /* printer name -> printer-state-reasons */
+    GHashTable *locations;      /* printer name -> printer-location */
+    GHashTable *classes;        /* set of printer names which are classes */
+    GHashTable *jobs;           /* job id -> printer name */
+    GHashTable *held;           /* set of job ids which are held */
+} Snapshot;
+
+
+/* a targeted refresh of a few printers */
+typedef struct
+{
+    IndicatorPrintersStore *store;
+    gchar **printers;
+} Refresh;
+
+
+typedef struct
+{
+    IndicatorPrintersStore *store;
+    guint job_id;
+    gchar *printer;
+} JobQuery;
+
+
+/* skipped job ids that are being looked for with a Get-Jobs */
+typedef struct
+{
+    IndicatorPrintersStore *store;
+    guint first_id;
+    guint last_id;
+} JobGap;
+
+
+struct _IndicatorPrintersStorePrivate
+{
+    CupsNotifier *cups_notifier;
+    IndicatorIppClient *ipp_client;
+    GHashTable *printers;       /* printer name -> Printer */
+    GHashTable *jobs;           /* active job id of the current user -> Printer */
+    GHashTable *held_jobs;      /* set of those jobs which are held */
+    GHashTable *foreign_jobs;   /* set of active job ids of other users */
+    GHashTable *pending_jobs;   /* set of job ids whose owner is being queried */
+    GHashTable *refreshing;     /* set of printer names being refreshed */
+    guint snapshot_generation;
+
+    /* lost signals are detected from skipped job ids that turn out to
+     * belong to active jobs, and from printers that went idle while they
+     * still have active jobs of the user that aren't held */
+    guint last_job_id;          /* highest job id seen in a signal */
+    GHashTable *suspects;       /* set of printer names to check at the next flush */
+    guint gaps_detected;
+
+    /* events are collected for coalesce_window milliseconds (or until the
+     * next idle if it is 0) before printer-changed is emitted once for each
+     * dirty printer */
+    guint coalesce_window;
+    guint flush_id;
+    GHashTable *dirty;          /* set of Printer */
+    gboolean resync_pending;
+    guint events_received;
+    guint events_merged;
+
+    /* in lazy mode, job events only trigger a cheap check whether the user
+     * has any active jobs at all.  Everything else is loaded by
+     * indicator_printers_store_populate() and kept for populate_ttl
+     * milliseconds. */
+    gboolean lazy;
+    guint populate_ttl;
+    gint64 populated_at;        /* monotonic time of the last populate */
+    gboolean has_jobs;
+    gboolean probe_pending;
+    gboolean probing;
+
+    /* the printers are saved to cache_file every cache_interval seconds if
+     * they changed, and when the store is disposed.  A new store starts out
+     * with the saved printers until its first reload has finished. */
+    gchar *cache_file;
+    guint cache_interval;
+    guint cache_save_id;
+    gboolean cache_dirty;
+};
+
+
+enum {
+    PROP_0,
+    PROP_CUPS_NOTIFIER,
+    PROP_IPP_CLIENT,
+    PROP_COALESCE_WINDOW,
+    PROP_LAZY,
+    PROP_POPULATE_TTL,
+    PROP_HAS_JOBS,
+    PROP_CACHE_FILE,
+    PROP_CACHE_INTERVAL,
+    NUM_PROPERTIES
+};
+
+static GParamSpec *properties[NUM_PROPERTIES];
+
+
+enum {
+    PRINTER_CHANGED,
+    PRINTER_REMOVED,
+    NUM_SIGNALS
+};
+
+static guint signals[NUM_SIGNALS];
+
+
+static gboolean flush_events (gpointer user_data);
+
+
+static Printer *
+printer_new (const gchar *name)
+{
+    Printer *printer = g_slice_new0 (Printer);
+
+    printer->name = g_strdup (name);
+    printer->state = IPP_PRINTER_IDLE;
+
+    return printer;
+}
+
+
+static void
+printer_free (Printer *printer)
+{
+    g_free (printer->name);
+    g_free (printer->state_reasons);
+    g_free (printer->location);
+    g_slice_free (Printer, printer);
+}
+
+
+static Printer *
+lookup_or_add_printer (IndicatorPrintersStore *self,
+                       const gchar *name)
+{
+    Printer *printer;
+
+    printer = g_hash_table_lookup (self->priv->printers, name);
+    if (!printer) {
+        printer = printer_new (name);
+        g_hash_table_insert (self->priv->printers, printer->name, printer);
+    }
+
+    return printer;
+}
+
+
+static void
+set_job_held (IndicatorPrintersStore *self,
+              guint job_id,
+              Printer *printer,
+              gboolean held)
+{
+    gpointer key = GUINT_TO_POINTER (job_id);
+
+    if (held) {
+        if (g_hash_table_add (self->priv->held_jobs, key))
+            printer->nheld++;
+    }
+    else if (g_hash_table_remove (self->priv->held_jobs, key)) {
+        printer->nheld--;
+    }
+}
+
+
+static void
+add_job (IndicatorPrintersStore *self,
+         guint job_id,
+         Printer *printer,
+         gboolean held)
+{
+    g_hash_table_insert (self->priv->jobs, GUINT_TO_POINTER (job_id), printer);
+    printer->njobs++;
+    set_job_held (self, job_id, printer, held);
+}
+
+
+static void
+remove_printer_jobs (IndicatorPrintersStore *self,
+                     Printer *printer)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init (&iter, self->priv->jobs);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        if (value == printer) {
+            g_hash_table_remove (self->priv->held_jobs, key);
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+    printer->njobs = 0;
+    printer->nheld = 0;
+}
+
+
+/* Forgets about a printer which was deleted from CUPS */
+static void
+remove_printer (IndicatorPrintersStore *self,
+                Printer *printer)
+{
+    remove_printer_jobs (self, printer);
+    g_hash_table_remove (self->priv->dirty, printer);
+
+    g_signal_emit (self, signals[PRINTER_REMOVED], 0, printer->name);
+
+    /* frees printer */
+    g_hash_table_remove (self->priv->printers, printer->name);
+}
+
+
+static void
+reset (IndicatorPrintersStore *self)
+{
+    GHashTableIter iter;
+    Printer *printer;
+
+    g_hash_table_iter_init (&iter, self->priv->printers);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &printer)) {
+        printer->njobs = 0;
+        printer->nheld = 0;
+    }
+
+    g_hash_table_remove_all (self->priv->jobs);
+    g_hash_table_remove_all (self->priv->held_jobs);
+    g_hash_table_remove_all (self->priv->foreign_jobs);
+}
+
+
+static void
+set_has_jobs (IndicatorPrintersStore *self,
+              gboolean has_jobs)
+{
+    if (self->priv->has_jobs == has_jobs)
+        return;
+
+    self->priv->has_jobs = has_jobs;
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_HAS_JOBS]);
+}
+
+
+static void
+schedule_flush (IndicatorPrintersStore *self)
+{
+    if (self->priv->flush_id)
+        return;
+
+    if (self->priv->coalesce_window > 0)
+        self->priv->flush_id = g_timeout_add (self->priv->coalesce_window,
+                                              flush_events, self);
+    else
+        self->priv->flush_id = g_idle_add (flush_events, self);
+}
+
+
+static void
+queue_printer_changed (IndicatorPrintersStore *self,
+                       Printer *printer)
+{
+    if (self->priv->resync_pending ||
+        !g_hash_table_add (self->priv->dirty, printer))
+        self->priv->events_merged++;
+
+    schedule_flush (self);
+}
+
+
+static Snapshot *
+snapshot_new (IndicatorPrintersStore *self)
+{
+    Snapshot *snapshot = g_slice_new0 (Snapshot);
+
+    snapshot->store = g_object_ref (self);
+    snapshot->generation = ++self->priv->snapshot_generation;
+    snapshot->states = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    snapshot->reasons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    snapshot->locations = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    snapshot->classes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    snapshot->jobs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    snapshot->held = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    return snapshot;
+}
+
+
+static void
+snapshot_free (Snapshot *snapshot)
+{
+    g_object_unref (snapshot->store);
+    g_hash_table_unref (snapshot->states);
+    g_hash_table_unref (snapshot->reasons);
+    g_hash_table_unref (snapshot->locations);
+    g_hash_table_unref (snapshot->classes);
+    g_hash_table_unref (snapshot->jobs);
+    g_hash_table_unref (snapshot->held);
+    g_slice_free (Snapshot, snapshot);
+}
+
+
+/* Replaces the contents of the store with the snapshot.  printer-changed
+ * is only emitted for printers that differ from what was there before, so
+ * that a reload after a restart of cupsd (or on top of the cache) doesn't
+ * rebuild everything that listens to the store. */
+static void
+apply_snapshot (Snapshot *snapshot)
+{
+    IndicatorPrintersStore *self = snapshot->store;
+    GHashTable *old_njobs;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    /* a newer snapshot was requested in the meantime, or one of the
+     * requests failed and the store is left as it is */
+    if (snapshot->generation != self->priv->snapshot_generation ||
+        snapshot->failed)
+        return;
+
+    old_njobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    g_hash_table_iter_init (&iter, self->priv->printers);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        g_hash_table_insert (old_njobs, value,
+                             GINT_TO_POINTER (((Printer *) value)->njobs));
+
+    reset (self);
+
+    g_hash_table_iter_init (&iter, self->priv->printers);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        if (!g_hash_table_contains (snapshot->states, key)) {
+            Printer *printer = value;
+
+            g_hash_table_iter_steal (&iter);
+            g_hash_table_remove (self->priv->dirty, printer);
+            g_hash_table_remove (old_njobs, printer);
+            g_signal_emit (self, signals[PRINTER_REMOVED], 0, printer->name);
+            printer_free (printer);
+        }
+    }
+
+    g_hash_table_iter_init (&iter, snapshot->states);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        Printer *printer = lookup_or_add_printer (self, key);
+        gint state = GPOINTER_TO_INT (value);
+        const gchar *reasons = g_hash_table_lookup (snapshot->reasons, key);
+        const gchar *location = g_hash_table_lookup (snapshot->locations, key);
+        gboolean is_class = g_hash_table_contains (snapshot->classes, key);
+
+        if (printer->state == state &&
+            g_strcmp0 (printer->state_reasons, reasons) == 0 &&
+            g_strcmp0 (printer->location, location) == 0 &&
+            printer->is_class == is_class)
+            continue;
+
+        printer->state = state;
+        g_free (printer->state_reasons);
+        printer->state_reasons = g_strdup (reasons);
+        g_free (printer->location);
+        printer->location = g_strdup (location);
+        printer->is_class = is_class;
+        g_hash_table_add (self->priv->dirty, printer);
+    }
+
+    g_hash_table_iter_init (&iter, snapshot->jobs);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        add_job (self, GPOINTER_TO_UINT (key), lookup_or_add_printer (self, value),
+                 g_hash_table_contains (snapshot->held, key));
+
+    /* new printers and those whose job count changed */
+    g_hash_table_iter_init (&iter, self->priv->printers);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        Printer *printer = value;
+        gpointer njobs;
+
+        printer->jobs_loaded_at = g_get_monotonic_time ();
+
+        if (!g_hash_table_lookup_extended (old_njobs, printer, NULL, &njobs) ||
+            GPOINTER_TO_INT (njobs) != printer->njobs)
+            g_hash_table_add (self->priv->dirty, printer);
+    }
+
+    g_hash_table_unref (old_njobs);
+
+    /* gaps are only detected among signals that arrive after this */
+    self->priv->last_job_id = 0;
+
+    self->priv->populated_at = g_get_monotonic_time ();
+    set_has_jobs (self, g_hash_table_size (self->priv->jobs) > 0);
+    schedule_flush (self);
+}
+
+
+static void
+snapshot_query_done (Snapshot *snapshot)
+{
+    if (--snapshot->pending > 0)
+        return;
+
+    apply_snapshot (snapshot);
+    snapshot_free (snapshot);
+}
+
+
+/* job-printer-uri is ipp://host/printers/<name> or .../classes/<name> */
+static gchar *
+printer_name_from_uri (const gchar *printer_uri)
+{
+    const gchar *name;
+
+    if (!printer_uri)
+        return NULL;
+
+    name = strrchr (printer_uri, '/');
+    if (!name || !name[1])
+        return NULL;
+
+    return g_uri_unescape_string (name + 1, NULL);
+}
+
+
+static void
+got_jobs (GObject *source_object,
+          GAsyncResult *result,
+          gpointer user_data)
+{
+    Snapshot *snapshot = user_data;
+    ipp_t *resp;
+    ipp_attribute_t *attr;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (!resp) {
+        g_warning ("Error getting jobs from CUPS: %s", error->message);
+        g_error_free (error);
+        snapshot->failed = TRUE;
+        snapshot_query_done (snapshot);
+        return;
+    }
+
+    for (attr = ippFirstAttribute (resp); attr; attr = ippNextAttribute (resp)) {
+        gint job_id = 0;
+        gint state = IPP_JOB_PENDING;
+        const char *printer_uri = NULL;
+
+        while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
+            attr = ippNextAttribute (resp);
+
+        for (; attr && ippGetGroupTag (attr) == IPP_TAG_JOB; attr = ippNextAttribute (resp)) {
+            const char *name = ippGetName (attr);
+
+            if (g_strcmp0 (name, "job-id") == 0)
+                job_id = ippGetInteger (attr, 0);
+            else if (g_strcmp0 (name, "job-state") == 0)
+                state = ippGetInteger (attr, 0);
+            else if (g_strcmp0 (name, "job-printer-uri") == 0)
+                printer_uri = ippGetString (attr, 0, NULL);
+        }
+
+        if (job_id > 0 && state < IPP_JOB_CANCELED) {
+            gchar *name = printer_name_from_uri (printer_uri);
+            if (name) {
+                g_hash_table_insert (snapshot->jobs, GINT_TO_POINTER (job_id), name);
+                if (state == IPP_JOB_HELD)
+                    g_hash_table_add (snapshot->held, GINT_TO_POINTER (job_id));
+            }
+        }
+
+        if (!attr)
+            break;
+    }
+
+    ippDelete (resp);
+    snapshot_query_done (snapshot);
+}
+
+
+static void
+got_printers (GObject *source_object,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+    Snapshot *snapshot = user_data;
+    ipp_t *resp;
+    ipp_attribute_t *attr;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (!resp) {
+        g_warning ("Error getting printers from CUPS: %s", error->message);
+        g_error_free (error);
+        snapshot->failed = TRUE;
+        snapshot_query_done (snapshot);
+        return;
+    }
+
+    for (attr = ippFirstAttribute (resp); attr; attr = ippNextAttribute (resp)) {
+        const char *printer = NULL;
+        gint state = IPP_PRINTER_IDLE;
+        gchar *reasons = NULL;
+        const char *location = NULL;
+        gint type = 0;
+
+        while (attr && ippGetGroupTag (attr) != IPP_TAG_PRINTER)
+            attr = ippNextAttribute (resp);
+
+        for (; attr && ippGetGroupTag (attr) == IPP_TAG_PRINTER; attr = ippNextAttribute (resp)) {
+            if (g_strcmp0 (ippGetName (attr), "printer-name") == 0)
+                printer = ippGetString (attr, 0, NULL);
+            else if (g_strcmp0 (ippGetName (attr), "printer-state") == 0)
+                state = ippGetInteger (attr, 0);
+            else if (g_strcmp0 (ippGetName (attr), "printer-state-reasons") == 0 && !reasons)
+                reasons = indicator_ipp_join_keywords (attr);
+            else if (g_strcmp0 (ippGetName (attr), "printer-location") == 0)
+                location = ippGetString (attr, 0, NULL);
+            else if (g_strcmp0 (ippGetName (attr), "printer-type") == 0)
+                type = ippGetInteger (attr, 0);
+        }
+
+        if (printer) {
+            g_hash_table_insert (snapshot->states, g_strdup (printer),
+                                 GINT_TO_POINTER (state));
+            if (reasons)
+                g_hash_table_insert (snapshot->reasons, g_strdup (printer), reasons);
+            if (location && *location)
+                g_hash_table_insert (snapshot->locations, g_strdup (printer),
+                                     g_strdup (location));
+            if (type & CUPS_PRINTER_CLASS)
+                g_hash_table_add (snapshot->classes, g_strdup (printer));
+        }
+        else {
+            g_free (reasons);
+        }
+
+        if (!attr)
+            break;
+    }
+
+    ippDelete (resp);
+    snapshot_query_done (snapshot);
+}
+
+
+/* Reloads printers and the user's active jobs from CUPS with two requests,
+ * which are sent at the same time: CUPS-Get-Printers and a single Get-Jobs
+ * for all printers.  The result replaces the contents of the store once both
+ * replies have arrived. */
+static void
+load_snapshot (IndicatorPrintersStore *self)
+{
+    Snapshot *snapshot;
+    ipp_t *req;
+    static const char * const printer_attrs[] = {
+        "printer-name",
+        "printer-state",
+        "printer-state-reasons",
+        "printer-location",
+        "printer-type"
+    };
+    static const char * const job_attrs[] = {
+        "job-id",
+        "job-state",
+        "job-printer-uri",
+        "job-impressions-completed"
+    };
+
+    if (!self->priv->ipp_client)
+        return;
+
+    snapshot = snapshot_new (self);
+    snapshot->pending = 2;
+
+    req = ippNewRequest (CUPS_GET_PRINTERS);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                  "requesting-user-name", NULL, cupsUser ());
+    ippAddStrings (req, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                   "requested-attributes", G_N_ELEMENTS (printer_attrs), NULL,
+                   printer_attrs);
+
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     got_printers, snapshot);
+
+    indicator_ipp_client_send_async (self->priv->ipp_client,
+                                     indicator_ipp_new_get_jobs_request (NULL, job_attrs,
+                                                                         G_N_ELEMENTS (job_attrs)),
+                                     "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     got_jobs, snapshot);
+}
+
+
+static void
+got_any_jobs (GObject *source_object,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+    ipp_t *resp;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (resp) {
+        set_has_jobs (self, indicator_ipp_count_jobs (resp) > 0);
+        ippDelete (resp);
+    }
+    else {
+        g_warning ("Error checking for active jobs: %s", error->message);
+        g_error_free (error);
+    }
+
+    self->priv->probing = FALSE;
+
+    /* more job events arrived while waiting for the reply */
+    if (self->priv->probe_pending && self->priv->ipp_client)
+        schedule_flush (self);
+
+    g_object_unref (self);
+}
+
+
+/* Asks cupsd whether the user has any active jobs.  This is the only request
+ * that job events cause in lazy mode: a Get-Jobs which is limited to a
+ * single job-id. */
+static void
+probe_jobs (IndicatorPrintersStore *self)
+{
+    ipp_t *req;
+    static const char * const attrs[] = { "job-id" };
+
+    if (!self->priv->ipp_client)
+        return;
+
+    if (self->priv->probing) {
+        self->priv->probe_pending = TRUE;
+        return;
+    }
+
+    self->priv->probe_pending = FALSE;
+    self->priv->probing = TRUE;
+
+    req = indicator_ipp_new_get_jobs_request (NULL, attrs, G_N_ELEMENTS (attrs));
+    ippAddInteger (req, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "limit", 1);
+
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     got_any_jobs, g_object_ref (self));
+}
+
+
+/* Refreshes the printers that went idle with active jobs of the user which
+ * aren't held, if the jobs are still there after the signals for them were
+ * flushed. */
+static void
+refresh_suspects (IndicatorPrintersStore *self)
+{
+    GPtrArray *names;
+    GHashTableIter iter;
+    const gchar *name;
+
+    names = g_ptr_array_new_with_free_func (g_free);
+
+    g_hash_table_iter_init (&iter, self->priv->suspects);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL)) {
+        Printer *printer = g_hash_table_lookup (self->priv->printers, name);
+
+        if (printer && printer->state == IPP_PRINTER_IDLE &&
+            printer->njobs > printer->nheld) {
+            g_ptr_array_add (names, g_strdup (name));
+        }
+    }
+    g_hash_table_remove_all (self->priv->suspects);
+
+    if (names->len > 0) {
+        self->priv->gaps_detected++;
+        g_debug ("%u printers went idle with active jobs", names->len);
+
+        g_ptr_array_add (names, NULL);
+        indicator_printers_store_refresh_printers (self, (const gchar * const *) names->pdata);
+    }
+
+    g_ptr_array_unref (names);
+}
+
+
+static gboolean
+flush_events (gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+    GHashTable *dirty;
+    GHashTableIter iter;
+    Printer *printer;
+
+    self->priv->flush_id = 0;
+
+    /* the reply of the reload marks all printers dirty */
+    if (self->priv->resync_pending) {
+        self->priv->resync_pending = FALSE;
+        g_hash_table_remove_all (self->priv->suspects);
+        if (self->priv->lazy) {
+            self->priv->populated_at = 0;
+            self->priv->probe_pending = TRUE;
+        }
+        else {
+            load_snapshot (self);
+        }
+    }
+
+    if (g_hash_table_size (self->priv->suspects) > 0)
+        refresh_suspects (self);
+
+    if (self->priv->probe_pending)
+        probe_jobs (self);
+    else if (!self->priv->lazy)
+        set_has_jobs (self, g_hash_table_size (self->priv->jobs) > 0);
+
+    /* swap in a new set, so that handlers may queue further events */
+    dirty = self->priv->dirty;
+    self->priv->dirty = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    if (g_hash_table_size (dirty) > 0)
+        self->priv->cache_dirty = TRUE;
+
+    g_hash_table_iter_init (&iter, dirty);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &printer, NULL))
+        g_signal_emit (self, signals[PRINTER_CHANGED], 0, printer->name);
+
+    g_hash_table_unref (dirty);
+
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+got_job_owner (GObject *source_object,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+    JobQuery *query = user_data;
+    IndicatorPrintersStore *self = query->store;
+    gpointer key = GUINT_TO_POINTER (query->job_id);
+    ipp_t *resp;
+    ipp_attribute_t *attr;
+    gboolean is_mine = FALSE;
+    gboolean held = FALSE;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (resp) {
+        attr = ippFindAttribute (resp, "job-originating-user-name", IPP_TAG_NAME);
+        if (attr)
+            is_mine = g_strcmp0 (ippGetString (attr, 0, NULL), cupsUser ()) == 0;
+
+        attr = ippFindAttribute (resp, "job-state", IPP_TAG_ENUM);
+        held = attr && ippGetInteger (attr, 0) == IPP_JOB_HELD;
+
+        ippDelete (resp);
+    }
+    else {
+        g_warning ("Error getting attributes of job %u: %s",
+                   query->job_id, error->message);
+        g_error_free (error);
+    }
+
+    /* the job finished while waiting for the reply, or was already picked up
+     * by a reload */
+    if (!g_hash_table_remove (self->priv->pending_jobs, key) ||
+        g_hash_table_contains (self->priv->jobs, key))
+        goto out;
+
+    if (is_mine) {
+        Printer *printer = lookup_or_add_printer (self, query->printer);
+        add_job (self, query->job_id, printer, held);
+        queue_printer_changed (self, printer);
+    }
+    else {
+        g_hash_table_add (self->priv->foreign_jobs, key);
+    }
+
+out:
+    g_object_unref (query->store);
+    g_free (query->printer);
+    g_slice_free (JobQuery, query);
+}
+
+
+/* Asks cupsd whether job_id was submitted by the current user.  This is only
+ * done once per job, the answer is remembered in the job index afterwards. */
+static void
+query_job_owner (IndicatorPrintersStore *self,
+                 guint job_id,
+                 const gchar *printer)
+{
+    JobQuery *query;
+    ipp_t *req;
+    gchar *job_uri;
+    static const char * const attrs[] = {
+        "job-originating-user-name",
+        "job-state"
+    };
+
+    if (!self->priv->ipp_client ||
+        !g_hash_table_add (self->priv->pending_jobs, GUINT_TO_POINTER (job_id)))
+        return;
+
+    job_uri = g_strdup_printf ("ipp://localhost/jobs/%u", job_id);
+
+    req = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_URI,
+                  "job-uri", NULL, job_uri);
+    ippAddString (req, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                  "requesting-user-name", NULL, cupsUser ());
+    ippAddStrings (req, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                   "requested-attributes", G_N_ELEMENTS (attrs), NULL, attrs);
+
+    g_free (job_uri);
+
+    query = g_slice_new (JobQuery);
+    query->store = g_object_ref (self);
+    query->job_id = job_id;
+    query->printer = g_strdup (printer);
+
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     got_job_owner, query);
+}
+
+
+static void
+apply_printer_attributes (IndicatorPrintersStore *self,
+                          const gchar *name,
+                          ipp_t *attrs,
+                          ipp_t *jobs)
+{
+    Printer *printer;
+    ipp_attribute_t *attr;
+
+    printer = lookup_or_add_printer (self, name);
+
+    attr = ippFindAttribute (attrs, "printer-state", IPP_TAG_ENUM);
+    if (attr)
+        printer->state = ippGetInteger (attr, 0);
+
+    attr = ippFindAttribute (attrs, "printer-state-reasons", IPP_TAG_KEYWORD);
+    if (attr) {
+        g_free (printer->state_reasons);
+        printer->state_reasons = indicator_ipp_join_keywords (attr);
+    }
+
+    attr = ippFindAttribute (attrs, "printer-location", IPP_TAG_TEXT);
+    if (attr) {
+        const char *location = ippGetString (attr, 0, NULL);
+        g_free (printer->location);
+        printer->location = location && *location ? g_strdup (location) : NULL;
+    }
+
+    attr = ippFindAttribute (attrs, "printer-type", IPP_TAG_ENUM);
+    if (attr)
+        printer->is_class = (ippGetInteger (attr, 0) & CUPS_PRINTER_CLASS) != 0;
+
+    if (jobs) {
+        remove_printer_jobs (self, printer);
+        printer->jobs_loaded_at = g_get_monotonic_time ();
+
+        for (attr = ippFirstAttribute (jobs); attr; attr = ippNextAttribute (jobs)) {
+            gint job_id = 0;
+            gint state = IPP_JOB_PENDING;
+            gpointer key;
+
+            while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
+                attr = ippNextAttribute (jobs);
+
+            for (; attr && ippGetGroupTag (attr) == IPP_TAG_JOB; attr = ippNextAttribute (jobs)) {
+                if (g_strcmp0 (ippGetName (attr), "job-id") == 0)
+                    job_id = ippGetInteger (attr, 0);
+                else if (g_strcmp0 (ippGetName (attr), "job-state") == 0)
+                    state = ippGetInteger (attr, 0);
+            }
+
+            key = GINT_TO_POINTER (job_id);
+            if (job_id > 0) {
+                g_hash_table_remove (self->priv->pending_jobs, key);
+                g_hash_table_remove (self->priv->foreign_jobs, key);
+                if (!g_hash_table_contains (self->priv->jobs, key))
+                    add_job (self, job_id, printer, state == IPP_JOB_HELD);
+            }
+
+            if (!attr)
+                break;
+        }
+    }
+
+    queue_printer_changed (self, printer);
+}
+
+
+static void
+got_printer_refresh (GObject *source_object,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+    Refresh *refresh = user_data;
+    IndicatorPrintersStore *self = refresh->store;
+    GPtrArray *responses;
+    GError *error = NULL;
+    guint i;
+
+    responses = indicator_ipp_client_send_all_finish (INDICATOR_IPP_CLIENT (source_object),
+                                                      result, &error);
+    if (!responses) {
+        g_warning ("Error refreshing printers: %s", error->message);
+        g_error_free (error);
+        goto out;
+    }
+
+    /* responses come in pairs of printer attributes and jobs, in the order
+     * of refresh->printers */
+    for (i = 0; refresh->printers[i]; i++) {
+        ipp_t *attrs = g_ptr_array_index (responses, 2 * i);
+        ipp_t *jobs = g_ptr_array_index (responses, 2 * i + 1);
+
+        /* the printer doesn't exist (anymore) */
+        if (!attrs)
+            continue;
+
+        apply_printer_attributes (self, refresh->printers[i], attrs, jobs);
+    }
+
+    g_ptr_array_unref (responses);
+
+out:
+    for (i = 0; refresh->printers[i]; i++)
+        g_hash_table_remove (self->priv->refreshing, refresh->printers[i]);
+
+    g_object_unref (refresh->store);
+    g_strfreev (refresh->printers);
+    g_slice_free (Refresh, refresh);
+}
+
+
+static void
+got_gap_jobs (GObject *source_object,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+    JobGap *gap = user_data;
+    IndicatorPrintersStore *self = gap->store;
+    GHashTable *names;
+    ipp_t *resp;
+    ipp_attribute_t *attr;
+    guint found = 0;
+    GError *error = NULL;
+
+    resp = indicator_ipp_client_send_finish (INDICATOR_IPP_CLIENT (source_object),
+                                             result, &error);
+    if (!resp) {
+        g_warning ("Error looking for jobs %u to %u: %s",
+                   gap->first_id, gap->last_id, error->message);
+        g_error_free (error);
+        indicator_printers_store_queue_resync (self);
+        goto out;
+    }
+
+    /* printers with active jobs among the skipped ones */
+    names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    for (attr = ippFirstAttribute (resp); attr; attr = ippNextAttribute (resp)) {
+        gint job_id = 0;
+        const char *user = NULL;
+        const char *printer_uri = NULL;
+
+        while (attr && ippGetGroupTag (attr) != IPP_TAG_JOB)
+            attr = ippNextAttribute (resp);
+
+        for (; attr && ippGetGroupTag (attr) == IPP_TAG_JOB; attr = ippNextAttribute (resp)) {
+            const char *name = ippGetName (attr);
+
+            if (g_strcmp0 (name, "job-id") == 0)
+                job_id = ippGetInteger (attr, 0);
+            else if (g_strcmp0 (name, "job-originating-user-name") == 0)
+                user = ippGetString (attr, 0, NULL);
+            else if (g_strcmp0 (name, "job-printer-uri") == 0)
+                printer_uri = ippGetString (attr, 0, NULL);
+        }
+
+        if (job_id >= (gint) gap->first_id && job_id <= (gint) gap->last_id) {
+            gpointer key = GINT_TO_POINTER (job_id);
+            gchar *name;
+
+            found++;
+
+            /* the state changes of its printer were lost as well */
+            name = printer_name_from_uri (printer_uri);
+            if (name)
+                g_hash_table_add (names, name);
+
+            if (g_strcmp0 (user, cupsUser ()) != 0 &&
+                !g_hash_table_contains (self->priv->jobs, key))
+                g_hash_table_add (self->priv->foreign_jobs, key);
+        }
+
+        if (!attr)
+            break;
+    }
+
+    ippDelete (resp);
+
+    if (found > 0) {
+        const gchar **printers;
+
+        self->priv->gaps_detected++;
+        g_debug ("signals for %u active jobs between %u and %u were lost",
+                 found, gap->first_id, gap->last_id);
+
+        printers = (const gchar **) g_hash_table_get_keys_as_array (names, NULL);
+        if (printers[0])
+            indicator_printers_store_refresh_printers (self, printers);
+        g_free (printers);
+    }
+    else {
+        /* rejected or already finished jobs, nothing is missing */
+        g_debug ("no active jobs between %u and %u", gap->first_id, gap->last_id);
+    }
+
+    g_hash_table_unref (names);
+
+out:
+    g_object_unref (gap->store);
+    g_slice_free (JobGap, gap);
+}
+
+
+/* Job ids are handed out sequentially by cupsd across all printers and the
+ * subscription covers the jobs of all users, so a job id that skips ahead of
+ * the highest one seen may mean that the signals for the jobs in between
+ * were lost.  Ids are also used up by jobs that cupsd rejected, though, so
+ * the active jobs on all printers are fetched first.  Only the printers
+ * owning any of the skipped ids are refreshed. */
+static void
+check_job_sequence (IndicatorPrintersStore *self,
+                    guint job_id)
+{
+    guint last_job_id = self->priv->last_job_id;
+    JobGap *gap;
+    ipp_t *req;
+    ipp_attribute_t *attr;
+    static const char * const attrs[] = {
+        "job-id",
+        "job-originating-user-name",
+        "job-printer-uri"
+    };
+
+    if (job_id <= last_job_id)
+        return;
+
+    self->priv->last_job_id = job_id;
+
+    /* the first signal since the last reload */
+    if (last_job_id == 0 || job_id == last_job_id + 1 || !self->priv->ipp_client)
+        return;
+
+    req = indicator_ipp_new_get_jobs_request (NULL, attrs, G_N_ELEMENTS (attrs));
+    attr = ippFindAttribute (req, "my-jobs", IPP_TAG_BOOLEAN);
+    ippSetBoolean (req, &attr, 0, 0);
+
+    gap = g_slice_new (JobGap);
+    gap->store = g_object_ref (self);
+    gap->first_id = last_job_id + 1;
+    gap->last_id = job_id - 1;
+
+    indicator_ipp_client_send_async (self->priv->ipp_client, req, "/",
+                                     INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                     got_gap_jobs, gap);
+}
+
+
+/* A printer that goes idle while the user still has active jobs on it that
+ * aren't held has probably missed the signal for a finished job.  It is checked at the next
+ * flush, when the signals that belong to the same change have arrived. */
+static void
+check_printer_idle (IndicatorPrintersStore *self,
+                    Printer *printer,
+                    guint printer_state)
+{
+    if (printer_state == IPP_PRINTER_IDLE &&
+        printer->state != IPP_PRINTER_IDLE &&
+        printer->njobs > printer->nheld)
+        g_hash_table_add (self->priv->suspects, g_strdup (printer->name));
+}
+
+
+static void
+on_job_changed (CupsNotifier *cups_notifier,
+                const gchar *text,
+                const gchar *printer_uri,
+                const gchar *printer_name,
+                guint printer_state,
+                const gchar *printer_state_reasons,
+                gboolean printer_is_accepting_jobs,
+                guint job_id,
+                guint job_state,
+                const gchar *job_state_reasons,
+                const gchar *job_name,
+                guint job_impressions_completed,
+                gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+    gpointer key = GUINT_TO_POINTER (job_id);
+    Printer *printer;
+
+    self->priv->events_received++;
+
+    if (self->priv->lazy) {
+        GHashTableIter iter;
+
+        if (self->priv->probe_pending)
+            self->priv->events_merged++;
+        self->priv->probe_pending = TRUE;
+
+        /* the printer's job count is out of date now.  Completed jobs don't
+         * say which printer they were on. */
+        if (printer_name && *printer_name) {
+            printer = g_hash_table_lookup (self->priv->printers, printer_name);
+            if (printer)
+                printer->jobs_loaded_at = 0;
+        }
+        else {
+            g_hash_table_iter_init (&iter, self->priv->printers);
+            while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &printer))
+                printer->jobs_loaded_at = 0;
+        }
+
+        schedule_flush (self);
+        return;
+    }
+
+    check_job_sequence (self, job_id);
+
+    if (job_state >= IPP_JOB_CANCELED) {
+        /* CUPS doesn't send the printer's name for these events.  Look up the
+         * printer the job was queued on in the job index. */
+        printer = g_hash_table_lookup (self->priv->jobs, key);
+        if (printer) {
+            set_job_held (self, job_id, printer, FALSE);
+            g_hash_table_remove (self->priv->jobs, key);
+            printer->njobs--;
+            queue_printer_changed (self, printer);
+        }
+        else {
+            g_hash_table_remove (self->priv->foreign_jobs, key);
+            g_hash_table_remove (self->priv->pending_jobs, key);
+        }
+        return;
+    }
+
+    if (!printer_name || !*printer_name)
+        return;
+
+    if (g_hash_table_contains (self->priv->foreign_jobs, key))
+        return;
+
+    /* a queue that was added after the last reload; fetching it also tells
+     * whether the job is ours */
+    if (!g_hash_table_contains (self->priv->printers, printer_name)) {
+        const gchar *printers[] = { printer_name, NULL };
+        indicator_printers_store_refresh_printers (self, printers);
+        return;
+    }
+
+    printer = g_hash_table_lookup (self->priv->jobs, key);
+    if (!printer) {
+        query_job_owner (self, job_id, printer_name);
+        return;
+    }
+
+    set_job_held (self, job_id, printer, job_state == IPP_JOB_HELD);
+
+    if (printer->state == (gint) printer_state)
+        return;
+
+    check_printer_idle (self, printer, printer_state);
+    printer->state = printer_state;
+    queue_printer_changed (self, printer);
+}
+
+
+static void
+on_printer_state_changed (CupsNotifier *cups_notifier,
+                          const gchar *text,
+                          const gchar *printer_uri,
+                          const gchar *printer_name,
+                          guint printer_state,
+                          const gchar *printer_state_reasons,
+                          gboolean printer_is_accepting_jobs,
+                          gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+    Printer *printer;
+
+    self->priv->events_received++;
+
+    if (!printer_name || !*printer_name)
+        return;
+
+    printer = lookup_or_add_printer (self, printer_name);
+    if (printer->state == (gint) printer_state &&
+        g_strcmp0 (printer->state_reasons, printer_state_reasons) == 0)
+        return;
+
+    if (!self->priv->lazy)
+        check_printer_idle (self, printer, printer_state);
+    printer->state = printer_state;
+    g_free (printer->state_reasons);
+    printer->state_reasons = g_strdup (printer_state_reasons);
+    queue_printer_changed (self, printer);
+}
+
+
+static void
+on_printer_added (CupsNotifier *cups_notifier,
+                  const gchar *text,
+                  const gchar *printer_uri,
+                  const gchar *printer_name,
+                  guint printer_state,
+                  const gchar *printer_state_reasons,
+                  gboolean printer_is_accepting_jobs,
+                  gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+    Printer *printer;
+
+    self->priv->events_received++;
+
+    if (!printer_name || !*printer_name)
+        return;
+
+    printer = lookup_or_add_printer (self, printer_name);
+    printer->state = printer_state;
+    g_free (printer->state_reasons);
+    printer->state_reasons = g_strdup (printer_state_reasons);
+    queue_printer_changed (self, printer);
+}
+
+
+static void
+on_printer_deleted (CupsNotifier *cups_notifier,
+                    const gchar *text,
+                    const gchar *printer_uri,
+                    const gchar *printer_name,
+                    guint printer_state,
+                    const gchar *printer_state_reasons,
+                    gboolean printer_is_accepting_jobs,
+                    gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+    Printer *printer;
+
+    self->priv->events_received++;
+
+    if (!printer_name || !*printer_name)
+        return;
+
+    printer = g_hash_table_lookup (self->priv->printers, printer_name);
+    if (printer)
+        remove_printer (self, printer);
+}
+
+
+/* Fills the store with the printers that were saved by the last instance.
+ * Their jobs aren't known, only how many there were; the first reload
+ * replaces all of it. */
+static void
+load_cache (IndicatorPrintersStore *self)
+{
+    gchar *contents;
+    gsize length;
+    GVariant *cache, *printers;
+    GVariantIter iter;
+    guint32 version;
+    const gchar *name, *reasons, *location;
+    gint32 state, njobs;
+    gboolean is_class, has_jobs = FALSE;
+    GError *error = NULL;
+
+    if (!g_file_get_contents (self->priv->cache_file, &contents, &length, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Could not read %s: %s", self->priv->cache_file, error->message);
+        g_error_free (error);
+        return;
+    }
+
+    cache = g_variant_new_from_data (G_VARIANT_TYPE (CACHE_TYPE), contents, length,
+                                     FALSE, g_free, contents);
+    g_variant_ref_sink (cache);
+
+    g_variant_get (cache, "(u@a(sissbi))", &version, &printers);
+    if (version == CACHE_VERSION) {
+        g_variant_iter_init (&iter, printers);
+        while (g_variant_iter_next (&iter, "(&si&s&sbi)",
+                                    &name, &state, &reasons, &location, &is_class, &njobs)) {
+            Printer *printer;
+
+            /* a damaged cache might list a printer twice */
+            if (!*name || g_hash_table_contains (self->priv->printers, name))
+                continue;
+
+            printer = lookup_or_add_printer (self, name);
+            printer->state = state;
+            printer->state_reasons = *reasons ? g_strdup (reasons) : NULL;
+            printer->location = *location ? g_strdup (location) : NULL;
+            printer->is_class = is_class;
+            printer->njobs = MAX (njobs, 0);
+            has_jobs |= printer->njobs > 0;
+
+            queue_printer_changed (self, printer);
+        }
+    }
+
+    set_has_jobs (self, has_jobs);
+
+    g_variant_unref (printers);
+    g_variant_unref (cache);
+}
+
+
+static void
+save_cache (IndicatorPrintersStore *self)
+{
+    GVariantBuilder builder;
+    GVariant *cache;
+    GHashTableIter iter;
+    Printer *printer;
+    gchar *dir;
+    GError *error = NULL;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sissbi)"));
+
+    g_hash_table_iter_init (&iter, self->priv->printers);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &printer))
+        g_variant_builder_add (&builder, "(sissbi)",
+                               printer->name,
+                               printer->state,
+                               printer->state_reasons ? printer->state_reasons : "",
+                               printer->location ? printer->location : "",
+                               printer->is_class,
+                               printer->njobs);
+
+    cache = g_variant_ref_sink (g_variant_new (CACHE_TYPE, CACHE_VERSION, &builder));
+
+    dir = g_path_get_dirname (self->priv->cache_file);
+    g_mkdir_with_parents (dir, 0700);
+    g_free (dir);
+
+    if (!g_file_set_contents (self->priv->cache_file,
+                              g_variant_get_data (cache),
+                              g_variant_get_size (cache),
+                              &error)) {
+        g_warning ("Could not write %s: %s", self->priv->cache_file, error->message);
+        g_error_free (error);
+    }
+
+    self->priv->cache_dirty = FALSE;
+    g_variant_unref (cache);
+}
+
+
+static gboolean
+save_cache_timeout (gpointer user_data)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (user_data);
+
+    if (self->priv->cache_dirty)
+        save_cache (self);
+
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+get_property (GObject    *object,
+              guint       property_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (object);
+
+    switch (property_id) {
+        case PROP_CUPS_NOTIFIER:
+            g_value_set_object (value,
+                                indicator_printers_store_get_cups_notifier (self));
+            break;
+
+        case PROP_IPP_CLIENT:
+            g_value_set_object (value, self->priv->ipp_client);
+            break;
+
+        case PROP_COALESCE_WINDOW:
+            g_value_set_uint (value, self->priv->coalesce_window);
+            break;
+
+        case PROP_LAZY:
+            g_value_set_boolean (value, self->priv->lazy);
+            break;
+
+        case PROP_POPULATE_TTL:
+            g_value_set_uint (value, self->priv->populate_ttl);
+            break;
+
+        case PROP_HAS_JOBS:
+            g_value_set_boolean (value, self->priv->has_jobs);
+            break;
+
+        case PROP_CACHE_FILE:
+            g_value_set_string (value, self->priv->cache_file);
+            break;
+
+        case PROP_CACHE_INTERVAL:
+            g_value_set_uint (value, self->priv->cache_interval);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+set_property (GObject      *object,
+              guint         property_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (object);
+
+    switch (property_id) {
+        case PROP_CUPS_NOTIFIER:
+            indicator_printers_store_set_cups_notifier (self,
+                                                        g_value_get_object (value));
+            break;
+
+        case PROP_IPP_CLIENT:
+            self->priv->ipp_client = g_value_dup_object (value);
+            break;
+
+        case PROP_COALESCE_WINDOW:
+            self->priv->coalesce_window = g_value_get_uint (value);
+            break;
+
+        case PROP_LAZY:
+            self->priv->lazy = g_value_get_boolean (value);
+            break;
+
+        case PROP_POPULATE_TTL:
+            self->priv->populate_ttl = g_value_get_uint (value);
+            break;
+
+        case PROP_CACHE_FILE:
+            g_free (self->priv->cache_file);
+            self->priv->cache_file = g_value_dup_string (value);
+            break;
+
+        case PROP_CACHE_INTERVAL:
+            self->priv->cache_interval = g_value_get_uint (value);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static void
+dispose (GObject *object)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (object);
+
+    indicator_printers_store_set_cups_notifier (self, NULL);
+
+    if (self->priv->cache_save_id) {
+        g_source_remove (self->priv->cache_save_id);
+        self->priv->cache_save_id = 0;
+    }
+    if (self->priv->cache_file && self->priv->cache_dirty && self->priv->printers)
+        save_cache (self);
+
+    if (self->priv->flush_id) {
+        g_source_remove (self->priv->flush_id);
+        self->priv->flush_id = 0;
+    }
+    if (self->priv->dirty) {
+        g_hash_table_unref (self->priv->dirty);
+        self->priv->dirty = NULL;
+    }
+    if (self->priv->printers) {
+        g_hash_table_unref (self->priv->printers);
+        self->priv->printers = NULL;
+    }
+    if (self->priv->jobs) {
+        g_hash_table_unref (self->priv->jobs);
+        self->priv->jobs = NULL;
+    }
+    if (self->priv->held_jobs) {
+        g_hash_table_unref (self->priv->held_jobs);
+        self->priv->held_jobs = NULL;
+    }
+    if (self->priv->foreign_jobs) {
+        g_hash_table_unref (self->priv->foreign_jobs);
+        self->priv->foreign_jobs = NULL;
+    }
+    if (self->priv->pending_jobs) {
+        g_hash_table_unref (self->priv->pending_jobs);
+        self->priv->pending_jobs = NULL;
+    }
+    if (self->priv->refreshing) {
+        g_hash_table_unref (self->priv->refreshing);
+        self->priv->refreshing = NULL;
+    }
+    if (self->priv->suspects) {
+        g_hash_table_unref (self->priv->suspects);
+        self->priv->suspects = NULL;
+    }
+    g_clear_object (&self->priv->ipp_client);
+
+    G_OBJECT_CLASS (indicator_printers_store_parent_class)->dispose (object);
+}
+
+
+static void
+finalize (GObject *object)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (object);
+
+    g_free (self->priv->cache_file);
+
+    G_OBJECT_CLASS (indicator_printers_store_parent_class)->finalize (object);
+}
+
+
+static void
+constructed (GObject *object)
+{
+    IndicatorPrintersStore *self = INDICATOR_PRINTERS_STORE (object);
+
+    if (self->priv->cache_file) {
+        load_cache (self);
+        if (self->priv->cache_interval > 0)
+            self->priv->cache_save_id = g_timeout_add_seconds (self->priv->cache_interval,
+                                                               save_cache_timeout, self);
+    }
+
+    /* fill the store once; afterwards it is kept current from the arguments
+     * of the notifier's signals.  A lazy store waits for the first
+     * populate. */
+    if (self->priv->lazy)
+        probe_jobs (self);
+    else
+        load_snapshot (self);
+
+    G_OBJECT_CLASS (indicator_printers_store_parent_class)->constructed (object);
+}
+
+
+static void
+indicator_printers_store_class_init (IndicatorPrintersStoreClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (IndicatorPrintersStorePrivate));
+
+    object_class->get_property = get_property;
+    object_class->set_property = set_property;
+    object_class->dispose = dispose;
+    object_class->finalize = finalize;
+    object_class->constructed = constructed;
+
+    properties[PROP_CUPS_NOTIFIER] = g_param_spec_object ("cups-notifier",
+                                                          "Cups Notifier",
+                                                          "A cups notifier object",
+                                                          CUPS_TYPE_NOTIFIER,
+                                                          G_PARAM_READWRITE);
+
+    properties[PROP_IPP_CLIENT] = g_param_spec_object ("ipp-client",
+                                                       "IPP Client",
+                                                       "Client used for requests to cupsd",
+                                                       INDICATOR_TYPE_IPP_CLIENT,
+                                                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_COALESCE_WINDOW] = g_param_spec_uint ("coalesce-window",
+                                                          "Coalesce Window",
+                                                          "Milliseconds to collect events before "
+                                                          "updating, 0 to wait for the next idle",
+                                                          0, G_MAXUINT, 100,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+    properties[PROP_LAZY] = g_param_spec_boolean ("lazy",
+                                                  "Lazy",
+                                                  "Only track whether there are any jobs "
+                                                  "until the store is populated",
+                                                  FALSE,
+                                                  G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_POPULATE_TTL] = g_param_spec_uint ("populate-ttl",
+                                                       "Populate TTL",
+                                                       "Milliseconds for which a lazy store "
+                                                       "reuses the result of a populate",
+                                                       0, G_MAXUINT, 5000,
+                                                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+    properties[PROP_CACHE_FILE] = g_param_spec_string ("cache-file",
+                                                       "Cache File",
+                                                       "File the printers are saved to, "
+                                                       "or NULL to not save them",
+                                                       NULL,
+                                                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_CACHE_INTERVAL] = g_param_spec_uint ("cache-interval",
+                                                         "Cache Interval",
+                                                         "Seconds between saves of changed "
+                                                         "printers, 0 to only save on dispose",
+                                                         0, G_MAXUINT, 300,
+                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
+    properties[PROP_HAS_JOBS] = g_param_spec_boolean ("has-jobs",
+                                                      "Has Jobs",
+                                                      "Whether the user has any active jobs",
+                                                      FALSE,
+                                                      G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, NUM_PROPERTIES, properties);
+
+    /* emitted whenever the state or the number of active jobs of a printer
+     * changes */
+    signals[PRINTER_CHANGED] = g_signal_new ("printer-changed",
+                                             G_TYPE_FROM_CLASS (klass),
+                                             G_SIGNAL_RUN_LAST,
+                                             0,
+                                             NULL, NULL,
+                                             g_cclosure_marshal_VOID__STRING,
+                                             G_TYPE_NONE, 1,
+                                             G_TYPE_STRING);
+
+    /* emitted when a printer was deleted from CUPS */
+    signals[PRINTER_REMOVED] = g_signal_new ("printer-removed",
+                                             G_TYPE_FROM_CLASS (klass),
+                                             G_SIGNAL_RUN_LAST,
+                                             0,
+                                             NULL, NULL,
+                                             g_cclosure_marshal_VOID__STRING,
+                                             G_TYPE_NONE, 1,
+                                             G_TYPE_STRING);
+}
+
+
+static void
+indicator_printers_store_init (IndicatorPrintersStore *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+                                              INDICATOR_TYPE_PRINTERS_STORE,
+                                              IndicatorPrintersStorePrivate);
+
+    self->priv->printers = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) printer_free);
+    self->priv->jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->priv->held_jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->priv->foreign_jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->priv->pending_jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    self->priv->refreshing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    self->priv->suspects = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    self->priv->dirty = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+
+IndicatorPrintersStore *
+indicator_printers_store_new (CupsNotifier *cups_notifier,
+                              IndicatorIppClient *ipp_client)
+{
+    return g_object_new (INDICATOR_TYPE_PRINTERS_STORE,
+                         "cups-notifier", cups_notifier,
+                         "ipp-client", ipp_client,
+                         NULL);
+}
+
+
+CupsNotifier *
+indicator_printers_store_get_cups_notifier (IndicatorPrintersStore *self)
+{
+    return self->priv->cups_notifier;
+}
+
+
+void
+indicator_printers_store_set_cups_notifier (IndicatorPrintersStore *self,
+                                            CupsNotifier *cups_notifier)
+{
+    if (self->priv->cups_notifier) {
+        g_object_disconnect (self->priv->cups_notifier,
+                             "any-signal", on_job_changed, self,
+                             "any-signal", on_printer_state_changed, self,
+                             "any-signal", on_printer_added, self,
+                             "any-signal", on_printer_deleted, self,
+                             NULL);
+        g_clear_object (&self->priv->cups_notifier);
+    }
+
+    if (cups_notifier) {
+        self->priv->cups_notifier = g_object_ref (cups_notifier);
+        g_object_connect (self->priv->cups_notifier,
+                          "signal::job-created", on_job_changed, self,
+                          "signal::job-state", on_job_changed, self,
+                          "signal::job-completed", on_job_changed, self,
+                          "signal::printer-state-changed", on_printer_state_changed, self,
+                          "signal::printer-added", on_printer_added, self,
+                          "signal::printer-modified", on_printer_state_changed, self,
+                          "signal::printer-deleted", on_printer_deleted, self,
+                          NULL);
+    }
+}
+
+
+/* Schedules a full reload of the store from CUPS.  At most one reload is
+ * started per coalesce window; printer-changed is emitted for every printer
+ * that changed once it has finished. */
+void
+indicator_printers_store_queue_resync (IndicatorPrintersStore *self)
+{
+    if (self->priv->resync_pending)
+        self->priv->events_merged++;
+
+    self->priv->resync_pending = TRUE;
+    schedule_flush (self);
+}
+
+
+/* Loads all printers and the user's jobs in lazy mode, unless that was done
+ * less than populate-ttl milliseconds ago.  printer-changed is emitted for
+ * every printer that changed once the reply has arrived.  Eager stores are always
+ * current, this does nothing for them. */
+void
+indicator_printers_store_populate (IndicatorPrintersStore *self)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (!self->priv->lazy)
+        return;
+
+    if (self->priv->populated_at &&
+        now - self->priv->populated_at < (gint64) self->priv->populate_ttl * 1000)
+        return;
+
+    /* also keeps repeated calls from sending requests while waiting for the
+     * reply */
+    self->priv->populated_at = now;
+    load_snapshot (self);
+}
+
+
+/* Fetches the attributes and the user's active jobs of the given printers.
+ * The requests for all printers run concurrently on the IPP client's worker
+ * pool; the results are applied in the order of printers.  printer-changed
+ * is emitted for each printer that exists, and its job count is current
+ * afterwards if its jobs could be loaded. */
+void
+indicator_printers_store_refresh_printers (IndicatorPrintersStore *self,
+                                           const gchar * const *printers)
+{
+    Refresh *refresh;
+    GPtrArray *names;
+    GPtrArray *requests;
+    const gchar * const *p;
+    static const char * const printer_attrs[] = {
+        "printer-state",
+        "printer-state-reasons",
+        "printer-location",
+        "printer-type"
+    };
+    static const char * const job_attrs[] = {
+        "job-id",
+        "job-state"
+    };
+
+    if (!self->priv->ipp_client)
+        return;
+
+    names = g_ptr_array_new ();
+    requests = g_ptr_array_new ();
+
+    for (p = printers; *p; p++) {
+        if (!g_hash_table_add (self->priv->refreshing, g_strdup (*p)))
+            continue;
+
+        g_ptr_array_add (names, g_strdup (*p));
+        g_ptr_array_add (requests,
+                         indicator_ipp_new_get_printer_attributes_request (*p, printer_attrs,
+                                                                           G_N_ELEMENTS (printer_attrs)));
+        g_ptr_array_add (requests,
+                         indicator_ipp_new_get_jobs_request (*p, job_attrs,
+                                                             G_N_ELEMENTS (job_attrs)));
+    }
+    g_ptr_array_add (names, NULL);
+
+    if (requests->len == 0) {
+        g_strfreev ((gchar **) g_ptr_array_free (names, FALSE));
+        g_ptr_array_free (requests, TRUE);
+        return;
+    }
+
+    refresh = g_slice_new (Refresh);
+    refresh->store = g_object_ref (self);
+    refresh->printers = (gchar **) g_ptr_array_free (names, FALSE);
+
+    indicator_ipp_client_send_all_async (self->priv->ipp_client,
+                                         (ipp_t **) requests->pdata, requests->len,
+                                         "/",
+                                         INDICATOR_IPP_DEFAULT_TIMEOUT, NULL,
+                                         got_printer_refresh, refresh);
+
+    g_ptr_array_free (requests, TRUE);
+}
+
+
+void
+indicator_printers_store_get_event_stats (IndicatorPrintersStore *self,
+                                          guint *received,
+                                          guint *merged)
+{
+    if (received)
+        *received = self->priv->events_received;
+    if (merged)
+        *merged = self->priv->events_merged;
+}
+
+
+/* Returns how often lost signals were detected and repaired */
+guint
+indicator_printers_store_get_gaps_detected (IndicatorPrintersStore *self)
+{
+    return self->priv->gaps_detected;
+}
+
+
+/* Returns a list of the names of all known printers.  The names are owned by
+ * the store; free the list with g_list_free(). */
+GList *
+indicator_printers_store_get_printers (IndicatorPrintersStore *self)
+{
+    return g_hash_table_get_keys (self->priv->printers);
+}
+
+
+gboolean
+indicator_printers_store_has_printer (IndicatorPrintersStore *self,
+                                      const gchar *printer)
+{
+    return g_hash_table_contains (self->priv->printers, printer);
+}
+
+
+gint
+indicator_printers_store_get_printer_state (IndicatorPrintersStore *self,
+                                            const gchar *printer)
+{
+    Printer *p = g_hash_table_lookup (self->priv->printers, printer);
+    return p ? p->state : -1;
+}
+
+
+const gchar *
+indicator_printers_store_get_printer_state_reasons (IndicatorPrintersStore *self,
+                                                    const gchar *printer)
+{
+    Printer *p = g_hash_table_lookup (self->priv->printers, printer);
+    return p ? p->state_reasons : NULL;
+}
+
+
+gboolean
+indicator_printers_store_get_lazy (IndicatorPrintersStore *self)
+{
+    return self->priv->lazy;
+}
+
+
+gboolean
+indicator_printers_store_get_has_jobs (IndicatorPrintersStore *self)
+{
+    return self->priv->has_jobs;
+}
+
+
+/* Returns the printer-location of printer, or NULL if it has none */
+const gchar *
+indicator_printers_store_get_printer_location (IndicatorPrintersStore *self,
+                                              const gchar *printer)
+{
+    Printer *p = g_hash_table_lookup (self->priv->printers, printer);
+    return p ? p->location : NULL;
+}
+
+
+gboolean
+indicator_printers_store_get_printer_is_class (IndicatorPrintersStore *self,
+                                              const gchar *printer)
+{
+    Printer *p = g_hash_table_lookup (self->priv->printers, printer);
+    return p ? p->is_class : FALSE;
+}
+
+
+/* Returns the number of active jobs the current user has on printer, or -1
+ * if the printer is unknown. */
+gint
+indicator_printers_store_get_njobs (IndicatorPrintersStore *self,
+                                    const gchar *printer)
+{
+    Printer *p = g_hash_table_lookup (self->priv->printers, printer);
+    return p ? p->njobs : -1;
+}
+
+
+/* Returns whether the job count of printer is known to be current.  That is
+ * always the case for eager stores.  Lazy stores only know it if it was
+ * loaded less than populate-ttl milliseconds ago and no job events for that
+ * printer arrived since; it isn't known for printers from the cache. */
+gboolean
+indicator_printers_store_get_njobs_current (IndicatorPrintersStore *self,
+                                            const gchar *printer)
+{
+    Printer *p = g_hash_table_lookup (self->priv->printers, printer);
+
+    if (!p)
+        return FALSE;
+
+    if (!self->priv->lazy)
+        return TRUE;
+
+    return p->jobs_loaded_at &&
+           g_get_monotonic_time () - p->jobs_loaded_at < (gint64) self->priv->populate_ttl * 1000;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2012 Canonical Ltd.
+ *
+ * Authors: Lars Uebernickel <lars.uebernickel@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDICATOR_PRINTERS_STORE_H
+#define INDICATOR_PRINTERS_STORE_H
+
+#include <glib-object.h>
+
+#include "cups-notifier.h"
+#include "indicator-ipp-client.h"
+
+G_BEGIN_DECLS
+
+#define INDICATOR_TYPE_PRINTERS_STORE indicator_printers_store_get_type()
+
+#define INDICATOR_PRINTERS_STORE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  INDICATOR_TYPE_PRINTERS_STORE, IndicatorPrintersStore))
+
+#define INDICATOR_PRINTERS_STORE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  INDICATOR_TYPE_PRINTERS_STORE, IndicatorPrintersStoreClass))
+
+#define INDICATOR_IS_PRINTERS_STORE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  INDICATOR_TYPE_PRINTERS_STORE))
+
+#define INDICATOR_IS_PRINTERS_STORE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  INDICATOR_TYPE_PRINTERS_STORE))
+
+#define INDICATOR_PRINTERS_STORE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  INDICATOR_TYPE_PRINTERS_STORE, IndicatorPrintersStoreClass))
+
+typedef struct _IndicatorPrintersStore IndicatorPrintersStore;
+typedef struct _IndicatorPrintersStoreClass IndicatorPrintersStoreClass;
+typedef struct _IndicatorPrintersStorePrivate IndicatorPrintersStorePrivate;
+
+struct _IndicatorPrintersStore
+{
+  GObject parent;
+  IndicatorPrintersStorePrivate *priv;
+};
+
+struct _IndicatorPrintersStoreClass
+{
+  GObjectClass parent_class;
+};
+
+GType indicator_printers_store_get_type (void) G_GNUC_CONST;
+
+IndicatorPrintersStore * indicator_printers_store_new (CupsNotifier *cups_notifier,
+                                                       IndicatorIppClient *ipp_client);
+CupsNotifier * indicator_printers_store_get_cups_notifier (IndicatorPrintersStore *self);
+void indicator_printers_store_set_cups_notifier (IndicatorPrintersStore *self,
+                                                 CupsNotifier *cups_notifier);
+
+void indicator_printers_store_queue_resync (IndicatorPrintersStore *self);
+void indicator_printers_store_populate (IndicatorPrintersStore *self);
+void indicator_printers_store_refresh_printers (IndicatorPrintersStore *self,
+                                                const gchar * const *printers);
+void indicator_printers_store_get_event_stats (IndicatorPrintersStore *self,
+                                               guint *received,
+                                               guint *merged);
+guint indicator_printers_store_get_gaps_detected (IndicatorPrintersStore *self);
+
+GList * indicator_printers_store_get_printers (IndicatorPrintersStore *self);
+gboolean indicator_printers_store_has_printer (IndicatorPrintersStore *self,
+                                               const gchar *printer);
+gint indicator_printers_store_get_printer_state (IndicatorPrintersStore *self,
+                                                 const gchar *printer);
+const gchar * indicator_printers_store_get_printer_state_reasons (IndicatorPrintersStore *self,
+                                                                 const gchar *printer);
+const gchar * indicator_printers_store_get_printer_location (IndicatorPrintersStore *self,
+                                                           const gchar *printer);
+gboolean indicator_printers_store_get_printer_is_class (IndicatorPrintersStore *self,
+                                                       const gchar *printer);
+gboolean indicator_printers_store_get_lazy (IndicatorPrintersStore *self);
+gboolean indicator_printers_store_get_has_jobs (IndicatorPrintersStore *self);
+gint indicator_printers_store_get_njobs (IndicatorPrintersStore *self,
+                                         const gchar *printer);
+gboolean indicator_printers_store_get_njobs_current (IndicatorPrintersStore *self,
+                                                     const gchar *printer);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,228 @@
+
+#include "notified-state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+/* The notified state of up to NOTIFIED_STATE_SLOTS printers, kept in a file
+ * in the user's cache directory so that alerts aren't repeated after the
+ * service was restarted.  The file is a fixed size table which is mapped
+ * into memory as it is; printers are placed by the hash of their name with
+ * linear probing.  Entries of printers that were deleted are removed.  When
+ * the table is full anyway, the entry of the printer that was alerted about
+ * least recently is dropped, so that only state that is unlikely to matter
+ * anymore is lost.
+ *
+ * Only the well-known reasons have the same bit in every process, so the
+ * others are never stored. */
+
+#define NOTIFIED_STATE_MAGIC 0x32534e49   /* "INS2" */
+#define NOTIFIED_STATE_SLOTS 256
+
+typedef struct
+{
+    guint32 magic;
+    guint32 n_slots;
+    NotifiedStateEntry slots[NOTIFIED_STATE_SLOTS];
+} NotifiedStateFile;
+
+struct _NotifiedState
+{
+    NotifiedStateFile *file;
+    gboolean mapped;
+};
+
+
+static NotifiedStateFile *
+map_file (const gchar *path)
+{
+    NotifiedStateFile *file;
+    struct stat st;
+    int fd;
+
+    fd = g_open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        g_warning ("Could not open %s: %s", path, g_strerror (errno));
+        return NULL;
+    }
+
+    if (fstat (fd, &st) < 0 ||
+        (st.st_size != sizeof (NotifiedStateFile) &&
+         ftruncate (fd, sizeof (NotifiedStateFile)) < 0)) {
+        g_warning ("Could not resize %s: %s", path, g_strerror (errno));
+        close (fd);
+        return NULL;
+    }
+
+    file = mmap (NULL, sizeof (NotifiedStateFile), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (file == MAP_FAILED) {
+        g_warning ("Could not map %s: %s", path, g_strerror (errno));
+        return NULL;
+    }
+
+    /* a new file or one written by an incompatible version */
+    if (file->magic != NOTIFIED_STATE_MAGIC || file->n_slots != NOTIFIED_STATE_SLOTS) {
+        memset (file, 0, sizeof (NotifiedStateFile));
+        file->magic = NOTIFIED_STATE_MAGIC;
+        file->n_slots = NOTIFIED_STATE_SLOTS;
+    }
+
+    return file;
+}
+
+
+/* Opens the state file at path, or the default one in the user's cache
+ * directory if path is NULL.  If it can't be used, the state is only kept in
+ * memory. */
+NotifiedState *
+notified_state_open (const gchar *path)
+{
+    NotifiedState *state;
+    gchar *default_path = NULL;
+
+    if (!path) {
+        gchar *dir = g_build_filename (g_get_user_cache_dir (), "indicator-printers", NULL);
+        g_mkdir_with_parents (dir, 0700);
+        default_path = g_build_filename (dir, "notified-state", NULL);
+        path = default_path;
+        g_free (dir);
+    }
+
+    state = g_slice_new0 (NotifiedState);
+    state->file = map_file (path);
+    state->mapped = state->file != NULL;
+
+    if (!state->mapped) {
+        state->file = g_new0 (NotifiedStateFile, 1);
+        state->file->magic = NOTIFIED_STATE_MAGIC;
+        state->file->n_slots = NOTIFIED_STATE_SLOTS;
+    }
+
+    g_free (default_path);
+    return state;
+}
+
+
+void
+notified_state_close (NotifiedState *state)
+{
+    if (state->mapped)
+        munmap (state->file, sizeof (NotifiedStateFile));
+    else
+        g_free (state->file);
+
+    g_slice_free (NotifiedState, state);
+}
+
+
+/* Returns the entry of printer, or NULL if there is none */
+NotifiedStateEntry *
+notified_state_find (NotifiedState *state,
+                     const gchar *printer)
+{
+    NotifiedStateEntry *entry;
+    guint home, i;
+
+    home = g_str_hash (printer) % NOTIFIED_STATE_SLOTS;
+
+    for (i = 0; i < NOTIFIED_STATE_SLOTS; i++) {
+        entry = &state->file->slots[(home + i) % NOTIFIED_STATE_SLOTS];
+
+        if (entry->printer[0] == '\0')
+            break;
+
+        if (strncmp (entry->printer, printer, NOTIFIED_STATE_MAX_PRINTER_NAME) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+
+/* Empties slot and moves later entries of its probe sequence up, so that
+ * they stay reachable from their home slot */
+static void
+clear_slot (NotifiedState *state,
+            guint slot)
+{
+    NotifiedStateEntry *slots = state->file->slots;
+    guint i, home;
+
+    for (i = (slot + 1) % NOTIFIED_STATE_SLOTS;
+         slots[i].printer[0] != '\0' && i != slot;
+         i = (i + 1) % NOTIFIED_STATE_SLOTS) {
+        home = g_str_hash (slots[i].printer) % NOTIFIED_STATE_SLOTS;
+
+        /* the entry can move if its home isn't between slot and i */
+        if ((i > slot && (home <= slot || home > i)) ||
+            (i < slot && home <= slot && home > i)) {
+            slots[slot] = slots[i];
+            slot = i;
+        }
+    }
+
+    memset (&slots[slot], 0, sizeof (NotifiedStateEntry));
+}
+
+
+/* Returns the entry of printer, adding an empty one if there is none.
+ * Changes to it are written to the file directly. */
+NotifiedStateEntry *
+notified_state_lookup (NotifiedState *state,
+                       const gchar *printer)
+{
+    NotifiedStateEntry *entry;
+    guint home, i, oldest;
+
+    entry = notified_state_find (state, printer);
+    if (entry)
+        return entry;
+
+    for (i = 0; i < NOTIFIED_STATE_SLOTS; i++) {
+        if (state->file->slots[i].printer[0] == '\0')
+            break;
+    }
+
+    /* the table is full: drop the printer alerted about least recently */
+    if (i == NOTIFIED_STATE_SLOTS) {
+        oldest = 0;
+        for (i = 1; i < NOTIFIED_STATE_SLOTS; i++) {
+            if (state->file->slots[i].last_alert < state->file->slots[oldest].last_alert)
+                oldest = i;
+        }
+        clear_slot (state, oldest);
+    }
+
+    home = g_str_hash (printer) % NOTIFIED_STATE_SLOTS;
+    for (i = 0; i < NOTIFIED_STATE_SLOTS; i++) {
+        entry = &state->file->slots[(home + i) % NOTIFIED_STATE_SLOTS];
+        if (entry->printer[0] == '\0')
+            break;
+    }
+
+    memset (entry, 0, sizeof (NotifiedStateEntry));
+    g_strlcpy (entry->printer, printer, NOTIFIED_STATE_MAX_PRINTER_NAME);
+
+    return entry;
+}
+
+
+/* Forgets printer, e.g. because it was deleted */
+void
+notified_state_remove (NotifiedState *state,
+                       const gchar *printer)
+{
+    NotifiedStateEntry *entry;
+
+    entry = notified_state_find (state, printer);
+    if (entry)
+        clear_slot (state, entry - state->file->slots);
+}
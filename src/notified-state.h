@@ -0,0 +1,41 @@
+
+#ifndef NOTIFIED_STATE_H
+#define NOTIFIED_STATE_H
+
+#include <glib.h>
+
+#include "printer-state-reasons.h"
+
+#define NOTIFIED_STATE_MAX_PRINTER_NAME 128
+
+/* token bucket limiting the alerts for one reason of a printer */
+typedef struct
+{
+    gdouble tokens;
+    gint64 updated;             /* real time in microseconds, 0 for never */
+} NotifiedStateBucket;
+
+/* what the user was already told about a printer.  Entries live in a
+ * memory-mapped file and are written to in place. */
+typedef struct
+{
+    gchar printer[NOTIFIED_STATE_MAX_PRINTER_NAME];
+    PrinterStateReasons reasons;
+    gint64 last_alert;          /* real time in microseconds, 0 for never;
+                                 * the oldest entry is dropped first */
+    NotifiedStateBucket buckets[PRINTER_STATE_N_KNOWN_REASONS];
+} NotifiedStateEntry;
+
+typedef struct _NotifiedState NotifiedState;
+
+NotifiedState * notified_state_open (const gchar *path);
+void notified_state_close (NotifiedState *state);
+
+NotifiedStateEntry * notified_state_find (NotifiedState *state,
+                                          const gchar *printer);
+NotifiedStateEntry * notified_state_lookup (NotifiedState *state,
+                                            const gchar *printer);
+void notified_state_remove (NotifiedState *state,
+                            const gchar *printer);
+
+#endif
@@ -0,0 +1,89 @@
+#include "printer-state-reasons.h"
+
+#include <string.h>
+
+/* Maps the printer-state-reasons keywords that alerts are shown for to their
+ * bit, so that the reasons of a printer fit into a PrinterStateReasons and
+ * comparing two sets needs no string operations.  Other keywords are
+ * ignored.  Only used from the main thread. */
+
+static const gchar *known_reasons[PRINTER_STATE_N_KNOWN_REASONS] = {
+    "media-low",
+    "media-empty",
+    "toner-low",
+    "toner-empty",
+    "cover-open",
+    "door-open",
+    "cups-missing-filter",
+    "offline"
+};
+
+static GHashTable *reason_bits;         /* quark -> bit + 1 */
+
+
+static void
+ensure_registry ()
+{
+    guint i;
+
+    if (reason_bits)
+        return;
+
+    reason_bits = g_hash_table_new (g_direct_hash, g_direct_equal);
+    for (i = 0; i < PRINTER_STATE_N_KNOWN_REASONS; i++)
+        g_hash_table_insert (reason_bits,
+                             GUINT_TO_POINTER (g_quark_from_static_string (known_reasons[i])),
+                             GUINT_TO_POINTER (i + 1));
+}
+
+
+/* returns the bit of keyword, or -1 if it isn't one of the known reasons */
+static gint
+lookup_reason (const gchar *keyword)
+{
+    GQuark quark;
+
+    /* doesn't intern keywords that were never seen, which can't be known */
+    quark = g_quark_try_string (keyword);
+    if (quark == 0)
+        return -1;
+
+    return (gint) GPOINTER_TO_UINT (g_hash_table_lookup (reason_bits,
+                                                         GUINT_TO_POINTER (quark))) - 1;
+}
+
+
+/* Parses a space separated list of printer-state-reasons keywords into the
+ * set of known reasons among them */
+PrinterStateReasons
+printer_state_reasons_parse (const gchar *reasons)
+{
+    PrinterStateReasons set = 0;
+    gchar keyword[128];
+    const gchar *p;
+
+    ensure_registry ();
+
+    if (!reasons)
+        return 0;
+
+    for (p = reasons; *p; ) {
+        gsize len = strcspn (p, " ,");
+        gint bit;
+
+        if (len > 0 && len < sizeof keyword) {
+            memcpy (keyword, p, len);
+            keyword[len] = '\0';
+
+            bit = lookup_reason (keyword);
+            if (bit >= 0)
+                set |= G_GUINT64_CONSTANT (1) << bit;
+        }
+
+        p += len;
+        if (*p)
+            p++;
+    }
+
+    return set;
+}
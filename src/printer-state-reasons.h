@@ -0,0 +1,29 @@
+
+#ifndef PRINTER_STATE_REASONS_H
+#define PRINTER_STATE_REASONS_H
+
+#include <glib.h>
+
+/* the printer-state-reasons keywords that alerts are shown for, each with a
+ * fixed bit; all other keywords are ignored */
+typedef enum
+{
+    PRINTER_STATE_REASON_MEDIA_LOW,
+    PRINTER_STATE_REASON_MEDIA_EMPTY,
+    PRINTER_STATE_REASON_TONER_LOW,
+    PRINTER_STATE_REASON_TONER_EMPTY,
+    PRINTER_STATE_REASON_COVER_OPEN,
+    PRINTER_STATE_REASON_DOOR_OPEN,
+    PRINTER_STATE_REASON_CUPS_MISSING_FILTER,
+    PRINTER_STATE_REASON_OFFLINE,
+    PRINTER_STATE_N_KNOWN_REASONS
+} PrinterStateReason;
+
+/* a set of reasons, one bit per reason */
+typedef guint64 PrinterStateReasons;
+
+#define PRINTER_STATE_REASONS_HAS(set, reason) (((set) >> (reason)) & 1)
+
+PrinterStateReasons printer_state_reasons_parse (const gchar *reasons);
+
+#endif
@@ -0,0 +1,96 @@
+
+#include "service-config.h"
+
+/* Optional per-user settings of the service, read once at startup from
+ * $XDG_CONFIG_HOME/indicator-printers/service.conf.  All keys live in the
+ * [Service] group; missing keys fall back to the given defaults. */
+
+#define SERVICE_CONFIG_GROUP "Service"
+
+static GKeyFile *config;
+
+
+void
+service_config_load ()
+{
+    gchar *path;
+    GError *err = NULL;
+
+    service_config_free ();
+    config = g_key_file_new ();
+
+    path = g_build_filename (g_get_user_config_dir (),
+                             "indicator-printers", "service.conf", NULL);
+
+    if (!g_key_file_load_from_file (config, path, G_KEY_FILE_NONE, &err)) {
+        if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Could not load %s: %s", path, err->message);
+        g_error_free (err);
+    }
+
+    g_free (path);
+}
+
+
+void
+service_config_free ()
+{
+    if (config) {
+        g_key_file_free (config);
+        config = NULL;
+    }
+}
+
+
+gint
+service_config_get_int (const gchar *key,
+                        gint default_value)
+{
+    GError *err = NULL;
+    gint value;
+
+    if (!config)
+        return default_value;
+
+    value = g_key_file_get_integer (config, SERVICE_CONFIG_GROUP, key, &err);
+    if (err) {
+        g_error_free (err);
+        return default_value;
+    }
+
+    return value;
+}
+
+
+gboolean
+service_config_get_boolean (const gchar *key,
+                            gboolean default_value)
+{
+    GError *err = NULL;
+    gboolean value;
+
+    if (!config)
+        return default_value;
+
+    value = g_key_file_get_boolean (config, SERVICE_CONFIG_GROUP, key, &err);
+    if (err) {
+        g_error_free (err);
+        return default_value;
+    }
+
+    return value;
+}
+
+
+gchar *
+service_config_get_string (const gchar *key,
+                           const gchar *default_value)
+{
+    gchar *value = NULL;
+
+    if (config)
+        value = g_key_file_get_string (config, SERVICE_CONFIG_GROUP, key, NULL);
+
+    return value ? value : g_strdup (default_value);
+}
+
@@ -0,0 +1,18 @@
+
+#ifndef SERVICE_CONFIG_H
+#define SERVICE_CONFIG_H
+
+#include <glib.h>
+
+void service_config_load (void);
+void service_config_free (void);
+
+gint service_config_get_int (const gchar *key,
+                             gint default_value);
+gboolean service_config_get_boolean (const gchar *key,
+                                     gboolean default_value);
+gchar * service_config_get_string (const gchar *key,
+                                   const gchar *default_value);
+
+#endif
+
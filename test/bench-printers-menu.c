@@ -0,0 +1,153 @@
+
+#include <glib/gstdio.h>
+#include <libdbusmenu-glib/dbusmenu-glib.h>
+
+#include "cups-notifier.h"
+#include "indicator-printers-menu.h"
+#include "indicator-printers-store.h"
+
+/* Measures how long it takes to build the printers menu, to marshal its
+ * layout the way GetLayout does, and to update it after a single printer
+ * changed, for sites with 10 to 10000 printers.  Every printer has one job
+ * so that it gets an item. */
+
+#define N_UPDATES 100
+#define N_LOCATIONS 20
+
+
+typedef struct
+{
+    const gchar *group_by;
+    guint max_printers;
+} Config;
+
+
+static void
+run_main_loop (void)
+{
+    while (g_main_context_iteration (NULL, FALSE));
+}
+
+
+static gchar *
+write_cache (guint nprinters)
+{
+    GVariantBuilder builder;
+    GVariant *cache;
+    gchar *path;
+    guint i;
+    GError *error = NULL;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sissbi)"));
+    for (i = 0; i < nprinters; i++) {
+        gchar *name = g_strdup_printf ("printer-%05u", i);
+        gchar *location = g_strdup_printf ("Floor %u", i % N_LOCATIONS);
+
+        g_variant_builder_add (&builder, "(sissbi)", name, 3, "", location, FALSE, 1);
+        g_free (name);
+        g_free (location);
+    }
+    cache = g_variant_ref_sink (g_variant_new ("(ua(sissbi))", 1, &builder));
+
+    path = g_build_filename (g_get_user_cache_dir (), "printers-cache", NULL);
+    g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), &error);
+    g_assert_no_error (error);
+
+    g_variant_unref (cache);
+    return path;
+}
+
+
+static void
+bench (guint nprinters,
+       const Config *config)
+{
+    CupsNotifier *cups_notifier;
+    IndicatorPrintersStore *store;
+    IndicatorPrintersMenu *menu;
+    GVariant *layout;
+    gchar *cache_file;
+    gint64 start, built, marshalled, updated;
+    gsize layout_size;
+    guint i;
+
+    cache_file = write_cache (nprinters);
+    cups_notifier = cups_notifier_skeleton_new ();
+
+    start = g_get_monotonic_time ();
+
+    store = g_object_new (INDICATOR_TYPE_PRINTERS_STORE,
+                          "cups-notifier", cups_notifier,
+                          "cache-file", cache_file,
+                          "cache-interval", 0,
+                          "coalesce-window", 0,
+                          NULL);
+    menu = g_object_new (INDICATOR_TYPE_PRINTERS_MENU,
+                         "group-by", config->group_by,
+                         "max-printers", config->max_printers,
+                         "store", store,
+                         NULL);
+    run_main_loop ();
+
+    built = g_get_monotonic_time ();
+
+    layout = dbusmenu_menuitem_build_variant (indicator_printers_menu_get_root (menu), NULL, -1);
+    layout_size = g_variant_get_size (layout);
+    g_variant_unref (layout);
+
+    marshalled = g_get_monotonic_time ();
+
+    for (i = 0; i < N_UPDATES; i++) {
+        gchar *name = g_strdup_printf ("printer-%05u", g_random_int_range (0, nprinters));
+
+        cups_notifier_emit_printer_state_changed (cups_notifier, "Printer state changed",
+                                                  "", name, i % 2 ? 3 : 4,
+                                                  "none", TRUE);
+        run_main_loop ();
+        g_free (name);
+    }
+
+    updated = g_get_monotonic_time ();
+
+    g_print ("%8u  %-8s  %3u  %10.2f  %11.2f  %14lu  %11.1f\n",
+             nprinters, config->group_by, config->max_printers,
+             (built - start) / 1000.0,
+             (marshalled - built) / 1000.0,
+             (gulong) layout_size,
+             (gdouble) (updated - marshalled) / N_UPDATES);
+
+    g_object_unref (menu);
+    g_object_unref (store);
+    g_object_unref (cups_notifier);
+    g_unlink (cache_file);
+    g_free (cache_file);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static const guint sizes[] = { 10, 100, 1000, 10000 };
+    static const Config configs[] = {
+        { "none", 0 },
+        { "location", 0 },
+        { "none", 50 }
+    };
+    gchar *cache_dir;
+    guint i, j;
+
+    /* keeps the store cache out of the user's cache */
+    cache_dir = g_dir_make_tmp ("bench-printers-menu-XXXXXX", NULL);
+    g_assert (cache_dir != NULL);
+    g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
+    g_print ("printers  group-by  max  build (ms)  layout (ms)  layout (bytes)  update (us)\n");
+    for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+        for (j = 0; j < G_N_ELEMENTS (configs); j++)
+            bench (sizes[i], &configs[j]);
+    }
+
+    g_rmdir (cache_dir);
+    g_free (cache_dir);
+    return 0;
+}
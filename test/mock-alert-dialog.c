@@ -0,0 +1,62 @@
+
+#include "alert-dialog.h"
+
+/* Stands in for the alert dialog module: it doesn't need a display and
+ * lets tests see which dialogs the service would have shown. */
+
+static guint n_created;
+static gchar *last_text;
+
+
+static gpointer
+create (AlertDialogResponseFunc response,
+        gpointer user_data)
+{
+    n_created++;
+    return g_strdup ("dialog");
+}
+
+
+static void
+set_text (gpointer dialog,
+          const gchar *text,
+          const gchar *secondary_text)
+{
+    g_free (last_text);
+    last_text = g_strdup (text);
+}
+
+
+static void
+destroy (gpointer dialog)
+{
+    g_free (dialog);
+}
+
+
+static const AlertDialogFuncs funcs = {
+    create,
+    set_text,
+    destroy
+};
+
+
+const AlertDialogFuncs *
+alert_dialog_get_funcs (void)
+{
+    return &funcs;
+}
+
+
+guint
+mock_alert_dialog_get_n_created (void)
+{
+    return n_created;
+}
+
+
+const gchar *
+mock_alert_dialog_get_text (void)
+{
+    return last_text;
+}
@@ -0,0 +1,508 @@
+
+#include "mock-cupsd.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#define SUBSCRIPTION_ID 42
+
+
+typedef struct
+{
+    gint sequence;
+    gchar *printer;
+    gchar *reasons;
+    gint job_id;                /* 0 for printer events */
+    gint job_state;
+} Event;
+
+
+typedef struct
+{
+    gint id;
+    gchar *printer;
+    gchar *user;
+} Job;
+
+
+struct _MockCupsd
+{
+    GSocket *socket;
+    gint notify_get_interval;
+
+    /* everything below is shared with the connection threads */
+    GMutex lock;
+    GArray *events;
+    GHashTable *requests;       /* op -> count */
+    GHashTable *printer_requests; /* "op/printer" -> count */
+    GArray *polls;
+    GArray *jobs;
+    gboolean reject_dbus;
+};
+
+
+typedef struct
+{
+    MockCupsd *mock;
+    http_t *http;
+} Connection;
+
+
+static void
+event_clear (Event *event)
+{
+    g_free (event->printer);
+    g_free (event->reasons);
+}
+
+
+static void
+job_clear (Job *job)
+{
+    g_free (job->printer);
+    g_free (job->user);
+}
+
+
+/* The name of the printer the request is for, or NULL if it is for all
+ * printers */
+static gchar *
+get_request_printer (ipp_t *request)
+{
+    ipp_attribute_t *attr;
+    const char *uri, *name;
+
+    attr = ippFindAttribute (request, "printer-uri", IPP_TAG_URI);
+    uri = attr ? ippGetString (attr, 0, NULL) : NULL;
+    if (!uri)
+        return NULL;
+
+    name = strstr (uri, "/printers/");
+    if (!name)
+        return NULL;
+
+    return g_uri_unescape_string (name + strlen ("/printers/"), NULL);
+}
+
+
+static void
+add_jobs (MockCupsd *mock,
+          ipp_t *response,
+          ipp_t *request,
+          const gchar *printer)
+{
+    ipp_attribute_t *attr;
+    const char *user = NULL;
+    guint n = 0;
+    guint i;
+
+    attr = ippFindAttribute (request, "my-jobs", IPP_TAG_BOOLEAN);
+    if (attr && ippGetBoolean (attr, 0)) {
+        attr = ippFindAttribute (request, "requesting-user-name", IPP_TAG_NAME);
+        user = attr ? ippGetString (attr, 0, NULL) : NULL;
+    }
+
+    for (i = 0; i < mock->jobs->len; i++) {
+        Job *job = &g_array_index (mock->jobs, Job, i);
+        gchar *uri;
+
+        if (printer && g_strcmp0 (job->printer, printer) != 0)
+            continue;
+        if (user && g_strcmp0 (job->user, user) != 0)
+            continue;
+
+        if (n++ > 0)
+            ippAddSeparator (response);
+
+        uri = g_strdup_printf ("ipp://localhost/printers/%s", job->printer);
+        ippAddInteger (response, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-id", job->id);
+        ippAddString (response, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL, uri);
+        ippAddString (response, IPP_TAG_JOB, IPP_TAG_NAME,
+                      "job-originating-user-name", NULL, job->user);
+        ippAddInteger (response, IPP_TAG_JOB, IPP_TAG_ENUM, "job-state", IPP_JOB_PENDING);
+        g_free (uri);
+    }
+}
+
+
+static void
+add_events (MockCupsd *mock,
+            ipp_t *response,
+            gint sequence,
+            MockCupsdPoll *poll)
+{
+    guint i;
+
+    ippAddInteger (response, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                   "notify-get-interval", mock->notify_get_interval);
+
+    for (i = 0; i < mock->events->len; i++) {
+        Event *event = &g_array_index (mock->events, Event, i);
+
+        if (event->sequence < sequence)
+            continue;
+
+        if (poll->nevents++ > 0)
+            ippAddSeparator (response);
+
+        ippAddInteger (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER,
+                       "notify-subscription-id", SUBSCRIPTION_ID);
+        ippAddInteger (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER,
+                       "notify-sequence-number", event->sequence);
+        if (event->job_id > 0) {
+            ippAddString (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD,
+                          "notify-subscribed-event", NULL, "job-state-changed");
+            ippAddString (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_TEXT,
+                          "notify-text", NULL, "Job state changed");
+            ippAddInteger (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_INTEGER,
+                           "notify-job-id", event->job_id);
+            ippAddInteger (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM,
+                           "job-state", event->job_state);
+        }
+        else {
+            ippAddString (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD,
+                          "notify-subscribed-event", NULL, "printer-state-changed");
+            ippAddString (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_TEXT,
+                          "notify-text", NULL, "Printer state changed");
+        }
+        ippAddString (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_NAME,
+                      "printer-name", NULL, event->printer);
+        ippAddInteger (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_ENUM,
+                       "printer-state", IPP_PRINTER_IDLE);
+        ippAddString (response, IPP_TAG_EVENT_NOTIFICATION, IPP_TAG_KEYWORD,
+                      "printer-state-reasons", NULL, event->reasons);
+        ippAddBoolean (response, IPP_TAG_EVENT_NOTIFICATION,
+                       "printer-is-accepting-jobs", 1);
+    }
+}
+
+
+static ipp_t *
+respond (MockCupsd *mock,
+         ipp_t *request)
+{
+    ipp_t *response;
+    ipp_op_t op;
+    ipp_attribute_t *attr;
+    MockCupsdPoll poll = { 0 };
+    gchar *printer;
+    gchar *key;
+    guint n;
+
+    response = ippNewResponse (request);
+    op = ippGetOperation (request);
+    printer = get_request_printer (request);
+
+    g_mutex_lock (&mock->lock);
+
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (mock->requests, GINT_TO_POINTER (op)));
+    g_hash_table_insert (mock->requests, GINT_TO_POINTER (op), GUINT_TO_POINTER (n + 1));
+
+    key = g_strdup_printf ("%d/%s", op, printer ? printer : "");
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (mock->printer_requests, key));
+    g_hash_table_insert (mock->printer_requests, key, GUINT_TO_POINTER (n + 1));
+
+    switch (op)
+    {
+        case IPP_CREATE_PRINTER_SUBSCRIPTION:
+            /* what cupsd answers for schemes it has no notifier for */
+            if (mock->reject_dbus &&
+                ippFindAttribute (request, "notify-recipient-uri", IPP_TAG_URI)) {
+                ippSetStatusCode (response, IPP_NOT_POSSIBLE);
+                break;
+            }
+            ippAddInteger (response, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                           "notify-subscription-id", SUBSCRIPTION_ID);
+            break;
+
+        case IPP_GET_NOTIFICATIONS:
+            attr = ippFindAttribute (request, "notify-sequence-numbers", IPP_TAG_INTEGER);
+            poll.time = g_get_monotonic_time ();
+            poll.sequence = attr ? ippGetInteger (attr, 0) : 1;
+            add_events (mock, response, poll.sequence, &poll);
+            g_array_append_val (mock->polls, poll);
+            break;
+
+        case IPP_GET_JOBS:
+            add_jobs (mock, response, request, printer);
+            break;
+
+        default:
+            break;
+    }
+
+    g_mutex_unlock (&mock->lock);
+
+    g_free (printer);
+    return response;
+}
+
+
+/* Handles the requests of one client until it disconnects, the way
+ * ippeveprinter does */
+static gpointer
+serve_connection (gpointer user_data)
+{
+    Connection *con = user_data;
+    http_t *http = con->http;
+
+    while (httpWait (http, 30000)) {
+        char uri[1024];
+        http_state_t state;
+        http_status_t status;
+        ipp_t *request, *response;
+        ipp_state_t ipp_state;
+
+        state = httpReadRequest (http, uri, sizeof uri);
+        if (state != HTTP_STATE_POST)
+            break;
+
+        while ((status = httpUpdate (http)) == HTTP_STATUS_CONTINUE);
+        if (status != HTTP_STATUS_OK)
+            break;
+
+        if (httpGetExpect (http) == HTTP_STATUS_CONTINUE &&
+            httpWriteResponse (http, HTTP_STATUS_CONTINUE) < 0)
+            break;
+
+        request = ippNew ();
+        while ((ipp_state = ippRead (http, request)) != IPP_STATE_DATA) {
+            if (ipp_state == IPP_STATE_ERROR)
+                break;
+        }
+        if (ipp_state == IPP_STATE_ERROR) {
+            ippDelete (request);
+            break;
+        }
+
+        response = respond (con->mock, request);
+        ippDelete (request);
+
+        httpClearFields (http);
+        httpSetField (http, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+        httpSetLength (http, ippLength (response));
+        if (httpWriteResponse (http, HTTP_STATUS_OK) < 0) {
+            ippDelete (response);
+            break;
+        }
+
+        ippSetState (response, IPP_STATE_IDLE);
+        ipp_state = ippWrite (http, response);
+        ippDelete (response);
+        if (ipp_state != IPP_STATE_DATA)
+            break;
+    }
+
+    httpClose (http);
+    g_slice_free (Connection, con);
+    return NULL;
+}
+
+
+static gpointer
+accept_connections (gpointer user_data)
+{
+    MockCupsd *mock = user_data;
+    http_t *http;
+
+    while ((http = httpAcceptConnection (g_socket_get_fd (mock->socket), 1))) {
+        Connection *con = g_slice_new (Connection);
+
+        con->mock = mock;
+        con->http = http;
+        g_thread_unref (g_thread_new ("mock-cupsd-connection", serve_connection, con));
+    }
+
+    return NULL;
+}
+
+
+/* Starts listening; the mock keeps running until the process exits */
+MockCupsd *
+mock_cupsd_new (gint notify_get_interval)
+{
+    MockCupsd *mock;
+    GSocketAddress *address;
+    GInetAddress *loopback;
+    GError *error = NULL;
+
+    mock = g_slice_new0 (MockCupsd);
+    mock->notify_get_interval = notify_get_interval;
+    g_mutex_init (&mock->lock);
+    mock->events = g_array_new (FALSE, FALSE, sizeof (Event));
+    g_array_set_clear_func (mock->events, (GDestroyNotify) event_clear);
+    mock->requests = g_hash_table_new (g_direct_hash, g_direct_equal);
+    mock->printer_requests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    mock->polls = g_array_new (FALSE, FALSE, sizeof (MockCupsdPoll));
+    mock->jobs = g_array_new (FALSE, FALSE, sizeof (Job));
+    g_array_set_clear_func (mock->jobs, (GDestroyNotify) job_clear);
+
+    mock->socket = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                                 G_SOCKET_PROTOCOL_TCP, &error);
+    g_assert_no_error (error);
+
+    loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new (loopback, 0);
+    g_socket_bind (mock->socket, address, TRUE, &error);
+    g_assert_no_error (error);
+    g_socket_listen (mock->socket, &error);
+    g_assert_no_error (error);
+    g_object_unref (address);
+    g_object_unref (loopback);
+
+    g_thread_unref (g_thread_new ("mock-cupsd", accept_connections, mock));
+
+    return mock;
+}
+
+
+guint16
+mock_cupsd_get_port (MockCupsd *mock)
+{
+    GSocketAddress *address;
+    guint16 port;
+
+    address = g_socket_get_local_address (mock->socket, NULL);
+    port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address));
+    g_object_unref (address);
+
+    return port;
+}
+
+
+/* Forgets all events, jobs and requests */
+void
+mock_cupsd_reset (MockCupsd *mock)
+{
+    g_mutex_lock (&mock->lock);
+    g_array_set_size (mock->events, 0);
+    g_hash_table_remove_all (mock->requests);
+    g_hash_table_remove_all (mock->printer_requests);
+    g_array_set_size (mock->polls, 0);
+    g_array_set_size (mock->jobs, 0);
+    mock->reject_dbus = FALSE;
+    g_mutex_unlock (&mock->lock);
+}
+
+
+/* Makes Create-Printer-Subscription fail for dbus:// recipients, like a
+ * cupsd that was built without the dbus notifier */
+void
+mock_cupsd_set_reject_dbus (MockCupsd *mock,
+                            gboolean reject)
+{
+    g_mutex_lock (&mock->lock);
+    mock->reject_dbus = reject;
+    g_mutex_unlock (&mock->lock);
+}
+
+
+void
+mock_cupsd_add_printer_event (MockCupsd *mock,
+                              gint sequence,
+                              const gchar *printer,
+                              const gchar *reasons)
+{
+    Event event;
+
+    event.sequence = sequence;
+    event.printer = g_strdup (printer);
+    event.reasons = g_strdup (reasons);
+    event.job_id = 0;
+    event.job_state = 0;
+
+    g_mutex_lock (&mock->lock);
+    g_array_append_val (mock->events, event);
+    g_mutex_unlock (&mock->lock);
+}
+
+
+void
+mock_cupsd_add_job_event (MockCupsd *mock,
+                          gint sequence,
+                          const gchar *printer,
+                          gint job_id,
+                          ipp_jstate_t job_state)
+{
+    Event event;
+
+    event.sequence = sequence;
+    event.printer = g_strdup (printer);
+    event.reasons = g_strdup ("none");
+    event.job_id = job_id;
+    event.job_state = job_state;
+
+    g_mutex_lock (&mock->lock);
+    g_array_append_val (mock->events, event);
+    g_mutex_unlock (&mock->lock);
+}
+
+
+/* Adds an active job that Get-Jobs returns */
+void
+mock_cupsd_add_job (MockCupsd *mock,
+                    gint job_id,
+                    const gchar *printer,
+                    const gchar *user)
+{
+    Job job;
+
+    job.id = job_id;
+    job.printer = g_strdup (printer);
+    job.user = g_strdup (user);
+
+    g_mutex_lock (&mock->lock);
+    g_array_append_val (mock->jobs, job);
+    g_mutex_unlock (&mock->lock);
+}
+
+
+guint
+mock_cupsd_get_n_requests (MockCupsd *mock,
+                           ipp_op_t op)
+{
+    guint n;
+
+    g_mutex_lock (&mock->lock);
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (mock->requests, GINT_TO_POINTER (op)));
+    g_mutex_unlock (&mock->lock);
+
+    return n;
+}
+
+
+/* Counts the requests of op for printer, or those for all printers if
+ * printer is NULL */
+guint
+mock_cupsd_get_n_printer_requests (MockCupsd *mock,
+                                   ipp_op_t op,
+                                   const gchar *printer)
+{
+    gchar *key;
+    guint n;
+
+    key = g_strdup_printf ("%d/%s", op, printer ? printer : "");
+
+    g_mutex_lock (&mock->lock);
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (mock->printer_requests, key));
+    g_mutex_unlock (&mock->lock);
+
+    g_free (key);
+    return n;
+}
+
+
+/* Returns a copy of the Get-Notifications requests so far, as
+ * MockCupsdPoll */
+GArray *
+mock_cupsd_get_polls (MockCupsd *mock)
+{
+    GArray *polls;
+
+    g_mutex_lock (&mock->lock);
+    polls = g_array_sized_new (FALSE, FALSE, sizeof (MockCupsdPoll), mock->polls->len);
+    g_array_append_vals (polls, mock->polls->data, mock->polls->len);
+    g_mutex_unlock (&mock->lock);
+
+    return polls;
+}
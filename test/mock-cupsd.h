@@ -0,0 +1,51 @@
+
+#ifndef MOCK_CUPSD_H
+#define MOCK_CUPSD_H
+
+#include <glib.h>
+#include <cups/cups.h>
+
+/* Answers IPP requests on a port of 127.0.0.1, on threads of its own, like
+ * a cupsd with one ippget subscription and no printers.  Get-Notifications
+ * returns the events that were added with mock_cupsd_add_printer_event()
+ * and mock_cupsd_add_job_event() from the requested sequence number on, and
+ * Get-Jobs the jobs added with mock_cupsd_add_job().  All other operations
+ * succeed without returning anything. */
+
+typedef struct _MockCupsd MockCupsd;
+
+typedef struct
+{
+    gint64 time;                /* monotonic, when the request arrived */
+    gint sequence;              /* the requested notify-sequence-numbers */
+    guint nevents;              /* returned */
+} MockCupsdPoll;
+
+MockCupsd * mock_cupsd_new (gint notify_get_interval);
+guint16 mock_cupsd_get_port (MockCupsd *mock);
+void mock_cupsd_reset (MockCupsd *mock);
+void mock_cupsd_set_reject_dbus (MockCupsd *mock,
+                                 gboolean reject);
+
+void mock_cupsd_add_printer_event (MockCupsd *mock,
+                                   gint sequence,
+                                   const gchar *printer,
+                                   const gchar *reasons);
+void mock_cupsd_add_job_event (MockCupsd *mock,
+                               gint sequence,
+                               const gchar *printer,
+                               gint job_id,
+                               ipp_jstate_t job_state);
+void mock_cupsd_add_job (MockCupsd *mock,
+                         gint job_id,
+                         const gchar *printer,
+                         const gchar *user);
+
+guint mock_cupsd_get_n_requests (MockCupsd *mock,
+                                 ipp_op_t op);
+guint mock_cupsd_get_n_printer_requests (MockCupsd *mock,
+                                         ipp_op_t op,
+                                         const gchar *printer);
+GArray * mock_cupsd_get_polls (MockCupsd *mock);
+
+#endif
@@ -0,0 +1,168 @@
+
+#include "mock-notifications.h"
+
+#include <gio/gio.h>
+
+
+typedef struct
+{
+    guint32 replaces_id;
+    gchar *body;
+} Notification;
+
+
+struct _MockNotifications
+{
+    GDBusConnection *con;
+    guint object_id;
+    GArray *notified;
+};
+
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.Notifications'>"
+    "    <method name='Notify'>"
+    "      <arg type='s' name='app_name' direction='in'/>"
+    "      <arg type='u' name='replaces_id' direction='in'/>"
+    "      <arg type='s' name='app_icon' direction='in'/>"
+    "      <arg type='s' name='summary' direction='in'/>"
+    "      <arg type='s' name='body' direction='in'/>"
+    "      <arg type='as' name='actions' direction='in'/>"
+    "      <arg type='a{sv}' name='hints' direction='in'/>"
+    "      <arg type='i' name='expire_timeout' direction='in'/>"
+    "      <arg type='u' name='id' direction='out'/>"
+    "    </method>"
+    "    <signal name='NotificationClosed'>"
+    "      <arg type='u' name='id'/>"
+    "      <arg type='u' name='reason'/>"
+    "    </signal>"
+    "    <signal name='ActionInvoked'>"
+    "      <arg type='u' name='id'/>"
+    "      <arg type='s' name='action_key'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
+
+
+static void
+notification_clear (Notification *notification)
+{
+    g_free (notification->body);
+}
+
+
+static void
+handle_method_call (GDBusConnection *connection,
+                    const gchar *sender,
+                    const gchar *object_path,
+                    const gchar *interface_name,
+                    const gchar *method_name,
+                    GVariant *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer user_data)
+{
+    MockNotifications *mock = user_data;
+    Notification notification;
+
+    g_variant_get (parameters, "(&suss&s@as@a{sv}i)",
+                   NULL, &notification.replaces_id, NULL, NULL,
+                   &notification.body, NULL, NULL, NULL);
+    notification.body = g_strdup (notification.body);
+    g_array_append_val (mock->notified, notification);
+
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(u)", mock->notified->len));
+}
+
+
+static const GDBusInterfaceVTable interface_vtable = {
+    handle_method_call,
+    NULL,
+    NULL
+};
+
+
+MockNotifications *
+mock_notifications_new (const gchar *bus_address)
+{
+    MockNotifications *mock;
+    GDBusNodeInfo *info;
+    GVariant *reply;
+    GError *error = NULL;
+
+    mock = g_slice_new0 (MockNotifications);
+    mock->notified = g_array_new (FALSE, FALSE, sizeof (Notification));
+    g_array_set_clear_func (mock->notified, (GDestroyNotify) notification_clear);
+
+    mock->con = g_dbus_connection_new_for_address_sync (bus_address,
+                                                        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                        NULL, NULL, &error);
+    g_assert_no_error (error);
+
+    info = g_dbus_node_info_new_for_xml (introspection_xml, &error);
+    g_assert_no_error (error);
+
+    mock->object_id = g_dbus_connection_register_object (mock->con,
+                                                         "/org/freedesktop/Notifications",
+                                                         info->interfaces[0],
+                                                         &interface_vtable,
+                                                         mock, NULL,
+                                                         &error);
+    g_assert_no_error (error);
+    g_dbus_node_info_unref (info);
+
+    /* own the name before returning, so that no notification misses it */
+    reply = g_dbus_connection_call_sync (mock->con,
+                                         "org.freedesktop.DBus",
+                                         "/org/freedesktop/DBus",
+                                         "org.freedesktop.DBus",
+                                         "RequestName",
+                                         g_variant_new ("(su)",
+                                                        "org.freedesktop.Notifications",
+                                                        0x4 /* DO_NOT_QUEUE */),
+                                         G_VARIANT_TYPE ("(u)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1, NULL, &error);
+    g_assert_no_error (error);
+    g_variant_unref (reply);
+
+    return mock;
+}
+
+
+void
+mock_notifications_free (MockNotifications *mock)
+{
+    g_dbus_connection_unregister_object (mock->con, mock->object_id);
+    g_dbus_connection_close_sync (mock->con, NULL, NULL);
+    g_object_unref (mock->con);
+    g_array_free (mock->notified, TRUE);
+    g_slice_free (MockNotifications, mock);
+}
+
+
+guint
+mock_notifications_get_n_notified (MockNotifications *mock)
+{
+    return mock->notified->len;
+}
+
+
+guint32
+mock_notifications_get_replaces_id (MockNotifications *mock,
+                                    guint i)
+{
+    g_assert_cmpuint (i, <, mock->notified->len);
+    return g_array_index (mock->notified, Notification, i).replaces_id;
+}
+
+
+const gchar *
+mock_notifications_get_body (MockNotifications *mock,
+                             guint i)
+{
+    g_assert_cmpuint (i, <, mock->notified->len);
+    return g_array_index (mock->notified, Notification, i).body;
+}
@@ -0,0 +1,22 @@
+
+#ifndef MOCK_NOTIFICATIONS_H
+#define MOCK_NOTIFICATIONS_H
+
+#include <glib.h>
+
+/* A notification daemon that owns org.freedesktop.Notifications on the bus
+ * at a given address and records every notification it is asked to show.
+ * Notifications get the ids 1, 2, ... in the order they are sent. */
+
+typedef struct _MockNotifications MockNotifications;
+
+MockNotifications * mock_notifications_new (const gchar *bus_address);
+void mock_notifications_free (MockNotifications *mock);
+
+guint mock_notifications_get_n_notified (MockNotifications *mock);
+guint32 mock_notifications_get_replaces_id (MockNotifications *mock,
+                                            guint i);
+const gchar * mock_notifications_get_body (MockNotifications *mock,
+                                           guint i);
+
+#endif
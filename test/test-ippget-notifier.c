@@ -0,0 +1,437 @@
+
+#include <glib.h>
+
+#include "cups-notifier.h"
+#include "indicator-cups-subscription.h"
+#include "indicator-ipp-client.h"
+#include "indicator-ippget-notifier.h"
+#include "indicator-printers-store.h"
+#include "mock-cupsd.h"
+
+#define TIMEOUT_MS 10000
+
+/* what the mock suggests as poll interval, in seconds */
+#define NOTIFY_GET_INTERVAL 1
+
+/* allowed for requests reaching the mock out of step */
+#define JITTER_MS 10
+
+
+typedef struct
+{
+    guint min_interval;
+    guint max_interval;
+} Intervals;
+
+
+typedef struct
+{
+    IndicatorIppClient *ipp_client;
+    IndicatorPrintersStore *store;
+    IndicatorCupsSubscription *subscription;
+    IndicatorIppgetNotifier *notifier;
+    guint nlost;
+    guint nchanged;
+    guint nrejected;
+} Fixture;
+
+
+static MockCupsd *cupsd;
+
+static const Intervals fast_intervals = { 10, 50 };
+
+
+static gboolean
+timed_out (gpointer user_data)
+{
+    gboolean *flag = user_data;
+
+    *flag = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+
+/* iterates the main loop until check returns TRUE; fails the test if that
+ * doesn't happen within TIMEOUT_MS */
+static void
+wait_for (gboolean (*check) (Fixture *fixture, gconstpointer data),
+          Fixture *fixture,
+          gconstpointer data)
+{
+    gboolean expired = FALSE;
+    guint timeout_id;
+
+    timeout_id = g_timeout_add (TIMEOUT_MS, timed_out, &expired);
+    while (!check (fixture, data)) {
+        g_assert (!expired);
+        g_main_context_iteration (NULL, TRUE);
+    }
+    g_source_remove (timeout_id);
+}
+
+
+static void
+settle (guint ms)
+{
+    gboolean expired = FALSE;
+
+    g_timeout_add (ms, timed_out, &expired);
+    while (!expired)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+
+static gboolean
+subscribed (Fixture *fixture,
+            gconstpointer data)
+{
+    return indicator_cups_subscription_get_id (fixture->subscription) > 0;
+}
+
+
+static gboolean
+events_emitted (Fixture *fixture,
+                gconstpointer data)
+{
+    guint events;
+
+    indicator_ippget_notifier_get_poll_stats (fixture->notifier, NULL, &events);
+    return events >= GPOINTER_TO_UINT (data);
+}
+
+
+static gboolean
+printers_requested (Fixture *fixture,
+                    gconstpointer data)
+{
+    return mock_cupsd_get_n_requests (cupsd, CUPS_GET_PRINTERS) >= GPOINTER_TO_UINT (data);
+}
+
+
+static gboolean
+polled (Fixture *fixture,
+        gconstpointer data)
+{
+    GArray *polls;
+    gboolean done;
+
+    polls = mock_cupsd_get_polls (cupsd);
+    done = polls->len >= GPOINTER_TO_UINT (data);
+    g_array_unref (polls);
+
+    return done;
+}
+
+
+static void
+on_events_lost (IndicatorIppgetNotifier *notifier,
+                gpointer user_data)
+{
+    Fixture *fixture = user_data;
+
+    fixture->nlost++;
+}
+
+
+static void
+on_printer_state_changed (CupsNotifier *cups_notifier,
+                          const gchar *text,
+                          const gchar *printer_uri,
+                          const gchar *printer_name,
+                          guint printer_state,
+                          const gchar *printer_state_reasons,
+                          gboolean printer_is_accepting_jobs,
+                          gpointer user_data)
+{
+    Fixture *fixture = user_data;
+
+    fixture->nchanged++;
+}
+
+
+static void
+start_notifier (Fixture *fixture,
+                const Intervals *intervals)
+{
+    CupsNotifier *cups_notifier;
+
+    fixture->notifier = g_object_new (INDICATOR_TYPE_IPPGET_NOTIFIER,
+                                      "ipp-client", fixture->ipp_client,
+                                      "subscription", fixture->subscription,
+                                      "min-interval", intervals->min_interval,
+                                      "max-interval", intervals->max_interval,
+                                      NULL);
+    g_signal_connect_swapped (fixture->notifier, "events-lost",
+                              G_CALLBACK (indicator_printers_store_queue_resync),
+                              fixture->store);
+    g_signal_connect (fixture->notifier, "events-lost",
+                      G_CALLBACK (on_events_lost), fixture);
+
+    indicator_cups_subscription_set_pull (fixture->subscription, TRUE);
+
+    cups_notifier = indicator_ippget_notifier_get_cups_notifier (fixture->notifier);
+    indicator_printers_store_set_cups_notifier (fixture->store, cups_notifier);
+    indicator_cups_subscription_set_cups_notifier (fixture->subscription, cups_notifier);
+    g_signal_connect (cups_notifier, "printer-state-changed",
+                      G_CALLBACK (on_printer_state_changed), fixture);
+}
+
+
+static void
+create_objects (Fixture *fixture)
+{
+    mock_cupsd_reset (cupsd);
+
+    fixture->ipp_client = indicator_ipp_client_new (2);
+    fixture->store = g_object_new (INDICATOR_TYPE_PRINTERS_STORE,
+                                   "ipp-client", fixture->ipp_client,
+                                   "coalesce-window", 0,
+                                   NULL);
+    fixture->subscription = g_object_new (INDICATOR_TYPE_CUPS_SUBSCRIPTION,
+                                          "ipp-client", fixture->ipp_client,
+                                          "store", fixture->store,
+                                          NULL);
+}
+
+
+/* wired up like the service does when it falls back to polling, except
+ * that polling only starts once the subscription exists, so that the first
+ * polls aren't spaced by max-interval */
+static void
+fixture_setup (Fixture *fixture,
+               gconstpointer data)
+{
+    create_objects (fixture);
+
+    indicator_cups_subscription_set_pull (fixture->subscription, TRUE);
+    indicator_cups_subscription_subscribe (fixture->subscription);
+    wait_for (subscribed, fixture, NULL);
+
+    start_notifier (fixture, data);
+}
+
+
+static void
+on_recipient_rejected (IndicatorCupsSubscription *subscription,
+                       gpointer user_data)
+{
+    Fixture *fixture = user_data;
+
+    fixture->nrejected++;
+    start_notifier (fixture, &fast_intervals);
+}
+
+
+/* like the service's default of waiting for cupsd's D-Bus signals, with a
+ * cupsd that can't send them */
+static void
+fixture_setup_push (Fixture *fixture,
+                    gconstpointer data)
+{
+    create_objects (fixture);
+    mock_cupsd_set_reject_dbus (cupsd, TRUE);
+
+    g_signal_connect (fixture->subscription, "recipient-rejected",
+                      G_CALLBACK (on_recipient_rejected), fixture);
+    indicator_cups_subscription_subscribe (fixture->subscription);
+}
+
+
+static void
+fixture_teardown (Fixture *fixture,
+                  gconstpointer data)
+{
+    g_object_unref (fixture->notifier);
+    g_object_unref (fixture->subscription);
+    g_object_unref (fixture->store);
+    g_object_unref (fixture->ipp_client);
+
+    /* replies that are still on their way */
+    settle (100);
+}
+
+
+static void
+test_sequence_gap (Fixture *fixture,
+                   gconstpointer data)
+{
+    GArray *polls;
+    guint nprinters;
+
+    mock_cupsd_add_printer_event (cupsd, 1, "alpha", "media-low");
+    mock_cupsd_add_printer_event (cupsd, 2, "alpha", "none");
+    wait_for (events_emitted, fixture, GUINT_TO_POINTER (2));
+    g_assert_cmpuint (fixture->nlost, ==, 0);
+
+    /* the initial reload of the store */
+    wait_for (printers_requested, fixture, GUINT_TO_POINTER (1));
+    settle (100);
+    nprinters = mock_cupsd_get_n_requests (cupsd, CUPS_GET_PRINTERS);
+
+    /* cupsd dropped events 3 and 4 before they were fetched */
+    mock_cupsd_add_printer_event (cupsd, 5, "alpha", "media-empty");
+    mock_cupsd_add_printer_event (cupsd, 6, "beta", "none");
+    wait_for (events_emitted, fixture, GUINT_TO_POINTER (4));
+    g_assert_cmpuint (fixture->nlost, ==, 1);
+    g_assert_cmpuint (fixture->nchanged, ==, 4);
+
+    /* the store reloads everything */
+    wait_for (printers_requested, fixture, GUINT_TO_POINTER (nprinters + 1));
+
+    /* and polling goes on after the last event */
+    polls = mock_cupsd_get_polls (cupsd);
+    wait_for (polled, fixture, GUINT_TO_POINTER (polls->len + 1));
+    g_array_unref (polls);
+
+    polls = mock_cupsd_get_polls (cupsd);
+    g_assert_cmpint (g_array_index (polls, MockCupsdPoll, polls->len - 1).sequence, ==, 7);
+    g_array_unref (polls);
+
+    settle (100);
+    g_assert_cmpuint (fixture->nlost, ==, 1);
+}
+
+
+static const Intervals backoff_intervals = { 50, 5000 };
+
+static void
+test_backoff (Fixture *fixture,
+              gconstpointer data)
+{
+    /* after events, polls are min-interval apart, and twice as far apart
+     * after each empty one, up to what cupsd suggested */
+    static const guint expected[] = { 50, 100, 200, 400, 800, 1000, 1000 };
+    GArray *polls;
+    guint first, i;
+
+    mock_cupsd_add_printer_event (cupsd, 1, "alpha", "media-low");
+    wait_for (events_emitted, fixture, GUINT_TO_POINTER (1));
+
+    polls = mock_cupsd_get_polls (cupsd);
+    for (first = 0; first < polls->len; first++) {
+        if (g_array_index (polls, MockCupsdPoll, first).nevents > 0)
+            break;
+    }
+    g_assert_cmpuint (first, <, polls->len);
+    g_array_unref (polls);
+
+    wait_for (polled, fixture, GUINT_TO_POINTER (first + G_N_ELEMENTS (expected) + 1));
+
+    polls = mock_cupsd_get_polls (cupsd);
+    for (i = 0; i < G_N_ELEMENTS (expected); i++) {
+        MockCupsdPoll *poll = &g_array_index (polls, MockCupsdPoll, first + i);
+        gint64 gap = (poll[1].time - poll[0].time) / 1000;
+
+        g_assert_cmpint (poll[1].nevents, ==, 0);
+        g_assert_cmpint (gap, >=, expected[i] - JITTER_MS);
+
+        /* doubling would have gone past the suggestion */
+        if (expected[i] == NOTIFY_GET_INTERVAL * 1000)
+            g_assert_cmpint (gap, <, expected[i] * 3 / 2);
+    }
+    g_array_unref (polls);
+
+    /* the next event brings the interval back down */
+    mock_cupsd_add_printer_event (cupsd, 2, "alpha", "none");
+    wait_for (events_emitted, fixture, GUINT_TO_POINTER (2));
+
+    polls = mock_cupsd_get_polls (cupsd);
+    for (first = polls->len - 1; g_array_index (polls, MockCupsdPoll, first).nevents == 0; first--);
+    g_array_unref (polls);
+
+    wait_for (polled, fixture, GUINT_TO_POINTER (first + 2));
+
+    polls = mock_cupsd_get_polls (cupsd);
+    g_assert_cmpint ((g_array_index (polls, MockCupsdPoll, first + 1).time -
+                      g_array_index (polls, MockCupsdPoll, first).time) / 1000, <, 500);
+    g_array_unref (polls);
+}
+
+
+static gboolean
+printer_refreshed (Fixture *fixture,
+                   gconstpointer data)
+{
+    return mock_cupsd_get_n_printer_requests (cupsd, IPP_GET_PRINTER_ATTRIBUTES, data) > 0;
+}
+
+
+static void
+test_job_gap (Fixture *fixture,
+              gconstpointer data)
+{
+    guint njobs;
+
+    /* the initial reload of the store */
+    wait_for (printers_requested, fixture, GUINT_TO_POINTER (1));
+    settle (100);
+    njobs = mock_cupsd_get_n_printer_requests (cupsd, IPP_GET_JOBS, NULL);
+
+    /* the signals for job 3 on beta were lost, job 2 was rejected */
+    mock_cupsd_add_job (cupsd, 3, "beta", "someone-else");
+    mock_cupsd_add_job_event (cupsd, 1, "alpha", 1, IPP_JOB_PROCESSING);
+    mock_cupsd_add_job_event (cupsd, 2, "alpha", 4, IPP_JOB_PROCESSING);
+    wait_for (events_emitted, fixture, GUINT_TO_POINTER (2));
+
+    /* the skipped ids are looked for on all printers, and the printer that
+     * has one is refreshed */
+    wait_for (printer_refreshed, fixture, "beta");
+    g_assert_cmpuint (mock_cupsd_get_n_printer_requests (cupsd, IPP_GET_JOBS, NULL), ==, njobs + 1);
+    g_assert_cmpuint (indicator_printers_store_get_gaps_detected (fixture->store), ==, 1);
+    g_assert_cmpuint (fixture->nlost, ==, 0);
+}
+
+
+static gboolean
+changed (Fixture *fixture,
+         gconstpointer data)
+{
+    return fixture->nchanged >= GPOINTER_TO_UINT (data);
+}
+
+
+static void
+test_dbus_rejected (Fixture *fixture,
+                    gconstpointer data)
+{
+    wait_for (subscribed, fixture, NULL);
+    g_assert_cmpuint (fixture->nrejected, ==, 1);
+    g_assert (indicator_cups_subscription_get_pull (fixture->subscription));
+    g_assert_cmpuint (mock_cupsd_get_n_requests (cupsd, IPP_CREATE_PRINTER_SUBSCRIPTION), ==, 2);
+
+    /* events arrive by polling instead */
+    mock_cupsd_add_printer_event (cupsd, 1, "alpha", "media-low");
+    mock_cupsd_add_printer_event (cupsd, 2, "beta", "none");
+    wait_for (changed, fixture, GUINT_TO_POINTER (2));
+    g_assert_cmpuint (fixture->nlost, ==, 0);
+
+    settle (100);
+    g_assert_cmpuint (fixture->nrejected, ==, 1);
+    g_assert_cmpuint (mock_cupsd_get_n_requests (cupsd, IPP_CREATE_PRINTER_SUBSCRIPTION), ==, 2);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    gchar *server;
+
+    g_test_init (&argc, &argv, NULL);
+
+    /* libcups reads the server from the environment on each thread */
+    cupsd = mock_cupsd_new (NOTIFY_GET_INTERVAL);
+    server = g_strdup_printf ("127.0.0.1:%u", mock_cupsd_get_port (cupsd));
+    g_setenv ("CUPS_SERVER", server, TRUE);
+    g_free (server);
+
+    g_test_add ("/ippget-notifier/sequence-gap", Fixture, &fast_intervals,
+                fixture_setup, test_sequence_gap, fixture_teardown);
+    g_test_add ("/ippget-notifier/backoff", Fixture, &backoff_intervals,
+                fixture_setup, test_backoff, fixture_teardown);
+    g_test_add ("/ippget-notifier/job-gap", Fixture, &fast_intervals,
+                fixture_setup, test_job_gap, fixture_teardown);
+    g_test_add ("/ippget-notifier/dbus-rejected", Fixture, NULL,
+                fixture_setup_push, test_dbus_rejected, fixture_teardown);
+
+    return g_test_run ();
+}
@@ -0,0 +1,313 @@
+
+#include <gio/gio.h>
+#include <gmodule.h>
+#include <string.h>
+
+#include "cups-notifier.h"
+#include "indicator-printers-store.h"
+#include "indicator-printer-state-notifier.h"
+#include "alert-dialog.h"
+#include "mock-notifications.h"
+
+#define TIMEOUT_MS 5000
+
+
+typedef struct
+{
+    GTestDBus *bus;
+    MockNotifications *notifications;
+    CupsNotifier *cups_notifier;
+    IndicatorPrintersStore *store;
+    IndicatorPrinterStateNotifier *notifier;
+    guint nchanged;
+} Fixture;
+
+
+static gboolean
+timed_out (gpointer user_data)
+{
+    gboolean *flag = user_data;
+
+    *flag = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+
+/* iterates the main loop until check returns TRUE; fails the test if that
+ * doesn't happen within TIMEOUT_MS */
+static void
+wait_for (gboolean (*check) (Fixture *fixture, gconstpointer data),
+          Fixture *fixture,
+          gconstpointer data)
+{
+    gboolean expired = FALSE;
+    guint timeout_id;
+
+    timeout_id = g_timeout_add (TIMEOUT_MS, timed_out, &expired);
+    while (!check (fixture, data)) {
+        g_assert (!expired);
+        g_main_context_iteration (NULL, TRUE);
+    }
+    g_source_remove (timeout_id);
+}
+
+
+/* lets pending timeouts of ms milliseconds run */
+static void
+settle (guint ms)
+{
+    gboolean expired = FALSE;
+
+    g_timeout_add (ms, timed_out, &expired);
+    while (!expired)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+
+static gboolean
+changed_since (Fixture *fixture,
+               gconstpointer data)
+{
+    return fixture->nchanged > GPOINTER_TO_UINT (data);
+}
+
+
+static gboolean
+notified (Fixture *fixture,
+          gconstpointer data)
+{
+    return mock_notifications_get_n_notified (fixture->notifications) >= GPOINTER_TO_UINT (data);
+}
+
+
+static void
+on_printer_changed (IndicatorPrintersStore *store,
+                    const gchar *printer,
+                    gpointer user_data)
+{
+    Fixture *fixture = user_data;
+
+    fixture->nchanged++;
+}
+
+
+/* the store starts out with each of printers having one of the user's
+ * jobs, so that alerts are shown for them */
+static gchar *
+write_cache (const gchar * const *printers)
+{
+    GVariantBuilder builder;
+    GVariant *cache;
+    gchar *path;
+    GError *error = NULL;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sissbi)"));
+    for (; *printers; printers++)
+        g_variant_builder_add (&builder, "(sissbi)", *printers, 3, "", "", FALSE, 1);
+    cache = g_variant_ref_sink (g_variant_new ("(ua(sissbi))", 1, &builder));
+
+    path = g_build_filename (g_get_user_cache_dir (), "printers-cache", NULL);
+    g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), &error);
+    g_assert_no_error (error);
+
+    g_variant_unref (cache);
+    return path;
+}
+
+
+static void
+fixture_setup (Fixture *fixture,
+               gconstpointer data)
+{
+    const gchar * const *printers = data;
+    gchar *cache_file;
+
+    fixture->bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (fixture->bus);
+
+    fixture->cups_notifier = cups_notifier_skeleton_new ();
+
+    cache_file = write_cache (printers);
+    fixture->store = g_object_new (INDICATOR_TYPE_PRINTERS_STORE,
+                                   "cups-notifier", fixture->cups_notifier,
+                                   "cache-file", cache_file,
+                                   "cache-interval", 0,
+                                   "coalesce-window", 0,
+                                   NULL);
+    g_free (cache_file);
+
+    fixture->notifier = g_object_new (INDICATOR_TYPE_PRINTER_STATE_NOTIFIER,
+                                      "store", fixture->store,
+                                      "alert-backend", "notification",
+                                      "notification-interval", 100,
+                                      "alert-cooldown", 600,
+                                      "alert-burst", 1,
+                                      "module-dir", MODULE_DIR,
+                                      NULL);
+
+    /* the printers loaded from the cache */
+    settle (10);
+
+    g_signal_connect (fixture->store, "printer-changed",
+                      G_CALLBACK (on_printer_changed), fixture);
+}
+
+
+static void
+fixture_teardown (Fixture *fixture,
+                  gconstpointer data)
+{
+    g_object_unref (fixture->notifier);
+    g_object_unref (fixture->store);
+    g_object_unref (fixture->cups_notifier);
+    if (fixture->notifications)
+        mock_notifications_free (fixture->notifications);
+
+    g_test_dbus_down (fixture->bus);
+    g_object_unref (fixture->bus);
+}
+
+
+/* emits a state change for printer and waits until the store passed it on */
+static void
+set_reasons (Fixture *fixture,
+             const gchar *printer,
+             const gchar *reasons)
+{
+    guint nchanged = fixture->nchanged;
+
+    cups_notifier_emit_printer_state_changed (fixture->cups_notifier,
+                                              "Printer state changed",
+                                              "ipp://localhost/printers/test",
+                                              printer,
+                                              4,
+                                              reasons,
+                                              TRUE);
+    wait_for (changed_since, fixture, GUINT_TO_POINTER (nchanged));
+}
+
+
+static const gchar * const batched_printers[] = { "alpha", "beta", NULL };
+
+static void
+test_batched (Fixture *fixture,
+              gconstpointer data)
+{
+    const gchar *body;
+
+    fixture->notifications = mock_notifications_new (g_test_dbus_get_bus_address (fixture->bus));
+
+    /* alerts raised within the notification interval share a notification */
+    set_reasons (fixture, "alpha", "media-empty");
+    set_reasons (fixture, "beta", "toner-empty");
+    wait_for (notified, fixture, GUINT_TO_POINTER (1));
+
+    settle (200);
+    g_assert_cmpuint (mock_notifications_get_n_notified (fixture->notifications), ==, 1);
+    g_assert_cmpuint (mock_notifications_get_replaces_id (fixture->notifications, 0), ==, 0);
+    body = mock_notifications_get_body (fixture->notifications, 0);
+    g_assert (strstr (body, "alpha") != NULL);
+    g_assert (strstr (body, "beta") != NULL);
+
+    /* later ones replace it */
+    set_reasons (fixture, "alpha", "media-empty cover-open");
+    wait_for (notified, fixture, GUINT_TO_POINTER (2));
+    g_assert_cmpuint (mock_notifications_get_replaces_id (fixture->notifications, 1), ==, 1);
+    body = mock_notifications_get_body (fixture->notifications, 1);
+    g_assert (strstr (body, "A cover is open") != NULL);
+}
+
+
+static const gchar * const suppressed_printers[] = { "gamma", NULL };
+
+static void
+test_suppressed (Fixture *fixture,
+                 gconstpointer data)
+{
+    guint shown, suppressed;
+
+    fixture->notifications = mock_notifications_new (g_test_dbus_get_bus_address (fixture->bus));
+
+    set_reasons (fixture, "gamma", "media-low");
+    wait_for (notified, fixture, GUINT_TO_POINTER (1));
+
+    /* toggling within the cooldown doesn't alert again */
+    set_reasons (fixture, "gamma", "none");
+    set_reasons (fixture, "gamma", "media-low");
+
+    settle (200);
+    g_assert_cmpuint (mock_notifications_get_n_notified (fixture->notifications), ==, 1);
+
+    indicator_printer_state_notifier_get_alert_stats (fixture->notifier, &shown, &suppressed);
+    g_assert_cmpuint (shown, ==, 1);
+    g_assert_cmpuint (suppressed, ==, 1);
+}
+
+
+static gboolean
+dialog_created (Fixture *fixture,
+                gconstpointer data)
+{
+    guint (*get_n_created) (void) = (guint (*) (void)) data;
+
+    return get_n_created () > 0;
+}
+
+
+static const gchar * const fallback_printers[] = { "delta", NULL };
+
+static void
+test_dialog_fallback (Fixture *fixture,
+                      gconstpointer data)
+{
+    GModule *module;
+    gchar *path;
+    guint (*get_n_created) (void);
+    const gchar * (*get_text) (void);
+
+    /* the same module the notifier loads */
+    path = g_module_build_path (MODULE_DIR, ALERT_DIALOG_MODULE_NAME);
+    module = g_module_open (path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+    g_assert (module != NULL);
+    g_assert (g_module_symbol (module, "mock_alert_dialog_get_n_created",
+                               (gpointer *) &get_n_created));
+    g_assert (g_module_symbol (module, "mock_alert_dialog_get_text",
+                               (gpointer *) &get_text));
+    g_free (path);
+
+    /* nobody owns org.freedesktop.Notifications */
+    set_reasons (fixture, "delta", "media-empty");
+    wait_for (dialog_created, fixture, (gconstpointer) get_n_created);
+
+    g_assert_cmpuint (get_n_created (), ==, 1);
+    g_assert (strstr (get_text (), "delta") != NULL);
+
+    g_module_close (module);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    gchar *cache_dir;
+    int result;
+
+    /* keeps the notified state and store cache out of the user's cache */
+    cache_dir = g_dir_make_tmp ("test-printer-alerts-XXXXXX", NULL);
+    g_assert (cache_dir != NULL);
+    g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/printer-alerts/batched", Fixture, batched_printers,
+                fixture_setup, test_batched, fixture_teardown);
+    g_test_add ("/printer-alerts/suppressed", Fixture, suppressed_printers,
+                fixture_setup, test_suppressed, fixture_teardown);
+    g_test_add ("/printer-alerts/dialog-fallback", Fixture, fallback_printers,
+                fixture_setup, test_dialog_fallback, fixture_teardown);
+
+    result = g_test_run ();
+
+    g_free (cache_dir);
+    return result;
+}